@@ -0,0 +1,65 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// walking over a floor of big squares through a forest, with triangles that need it clipped,
+// then with them dropped the way binning did before there was a clipper
+// dropping them also leaves out the floor under the camera, so the binning pass is timed on its own too
+// usage: bin/clip_bench [frames] [trees per side]
+
+double frame_ms(Scene &scene, RenderTarget &target, FrameContext &frame, int frames, double &bin_ms)
+{
+    Camera start_camera = scene.camera;
+    render_scene(scene, target, frame); // warm up the buffers
+    auto start = std::chrono::steady_clock::now();
+    bin_ms = 0;
+    for (int f = 0; f < frames; ++f)
+    {
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        scene.camera.transform.position = vector3(0, 1.5, f * 0.2);
+        scene.camera.transform.set_rotation(degrees_to_radians(f * 3.0), 0, 0);
+        render_scene(scene, target, frame);
+        bin_ms += frame.stats.bin_ms / frames;
+    }
+    scene.camera = start_camera;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+    int side = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    // floor.obj is 10 x 10, scaled to 60 x 60 squares
+    Model floor = load_object("objects/floor.obj", "textures/tile.bmp");
+    floor.cull = CullMode::None;
+    std::vector<Transform> squares;
+    for (int z = -1; z <= 1; ++z)
+        for (int x = -1; x <= 1; ++x)
+            squares.emplace_back(0, 0, 0, vector3(x * 60.0, 0, z * 60.0), vector3(6, 1, 6));
+    Model tree = load_object("objects/tree.obj", "textures/colMap.bytes");
+    std::vector<Transform> trees;
+    for (int z = 0; z < side; ++z)
+        for (int x = 0; x < side; ++x)
+            trees.emplace_back(x * 0.7 + z * 1.3, 0, 0, vector3((x - side / 2) * 3.0 + 1.5, 0, (z - side / 2) * 3.0 + 1.5));
+
+    Scene scene({}, Camera(60.0, Transform(0, 0, 0, vector3(0, 1.5, 0))));
+    scene.addInstanced(InstancedModel(floor, squares));
+    scene.addInstanced(InstancedModel(tree, trees));
+
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+    double clip_bin_ms, drop_bin_ms;
+    frame.clipper.enabled = true;
+    double clip_ms = frame_ms(scene, target, frame, frames, clip_bin_ms);
+    long long pieces = frame.stats.triangles_clipped;
+    frame.clipper.enabled = false;
+    double drop_ms = frame_ms(scene, target, frame, frames, drop_bin_ms);
+    long long dropped = frame.stats.setup.dropped;
+
+    std::printf("9 floor squares and %d trees, %lld triangles\n", side * side, frame.stats.triangles);
+    std::printf("  clipping:         %8.2f ms/frame, binning %6.2f ms, %lld pieces binned on the last frame\n", clip_ms, clip_bin_ms, pieces);
+    std::printf("  dropping instead: %8.2f ms/frame, binning %6.2f ms, %lld triangles dropped on the last frame\n", drop_ms, drop_bin_ms, dropped);
+    return 0;
+}
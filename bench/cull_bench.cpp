@@ -0,0 +1,58 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// a field of dragons drawn with and without back-face culling in triangle setup
+// usage: bin/cull_bench [frames] [rows]
+
+double frame_ms(Scene &scene, RenderTarget &target, FrameContext &frame, int frames)
+{
+    render_scene(scene, target, frame); // warm up the buffers
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        render_scene(scene, target, frame);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+    int rows = argc > 2 ? std::atoi(argv[2]) : 3;
+
+    Model dragon = load_object("objects/dragon.obj", "_no_texture", vector3(80, 255, 200));
+    std::vector<Transform> transforms;
+    for (int z = 0; z < rows; ++z)
+        for (int x = -2; x <= 2; ++x)
+            transforms.emplace_back(0, 0, 0, vector3(x * 2.5, 0, 5 + z * 3.0));
+
+    Scene scene({}, Camera(60.0, Transform(0, 0, 0, vector3(0, 1.5, -1))));
+    scene.addInstanced(InstancedModel(dragon, transforms));
+
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+    scene.instanced[0].cull = CullMode::None;
+    double none_ms = frame_ms(scene, target, frame, frames);
+    long long none_binned = frame.bins.binned_count();
+    std::vector<uint32_t> none_pixels = target.snapshot();
+
+    scene.instanced[0].cull = CullMode::Back;
+    double back_ms = frame_ms(scene, target, frame, frames);
+    long long back_binned = frame.bins.binned_count();
+    std::vector<uint32_t> back_pixels = target.snapshot();
+    int differing = 0;
+    for (size_t p = 0; p < none_pixels.size(); ++p)
+        differing += none_pixels[p] != back_pixels[p];
+
+    const SetupStats &setup = frame.stats.setup;
+    std::printf("%zu dragons, %lld triangles\n", transforms.size(), frame.stats.triangles);
+    std::printf("  no culling:         %8.2f ms/frame, %lld triangles binned\n", none_ms, none_binned);
+    std::printf("  back-face culling:  %8.2f ms/frame, %lld triangles binned\n", back_ms, back_binned);
+    std::printf("  setup rejected %lld back faces, %lld degenerate and %lld covering no pixel centre\n",
+                setup.culled, setup.degenerate, setup.missed);
+    std::printf("  %d pixels differ\n", differing);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// the main scene shaded forward and through the visibility buffer
+// usage: bin/deferred_bench [frames]
+
+double frame_ms(Scene &scene, RenderTarget &target, FrameContext &frame, int frames)
+{
+    render_scene(scene, target, frame); // warm up the buffers
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        render_scene(scene, target, frame);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+
+    Scene scene = create_main_scene();
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+
+    frame.visibility.enabled = false;
+    double forward_ms = frame_ms(scene, target, frame, frames);
+    long long forward_shaded = frame.stats.raster.pixels_shaded;
+    std::vector<uint32_t> forward_pixels = target.snapshot();
+
+    frame.visibility.enabled = true;
+    double deferred_ms = frame_ms(scene, target, frame, frames);
+    long long deferred_shaded = frame.stats.raster.pixels_shaded;
+
+    // both weigh pixels through the same TriangleEdges, so the images should match exactly
+    std::vector<uint32_t> deferred_pixels = target.snapshot();
+    int differing = 0;
+    for (size_t p = 0; p < forward_pixels.size(); ++p)
+        differing += forward_pixels[p] != deferred_pixels[p];
+
+    std::printf("main scene, %lld triangles\n", frame.stats.triangles);
+    std::printf("  forward:  %8.2f ms/frame, %lld pixels shaded\n", forward_ms, forward_shaded);
+    std::printf("  deferred: %8.2f ms/frame, %lld pixels shaded\n", deferred_ms, deferred_shaded);
+    std::printf("  %d of %zu pixels differ\n", differing, forward_pixels.size());
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// the main scene with a float and a 24-bit fixed point depth buffer
+// usage: bin/depth_bench [frames]
+
+double frame_ms(Scene &scene, RenderTarget &target, FrameContext &frame, int frames)
+{
+    render_scene(scene, target, frame); // warm up the buffers
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        render_scene(scene, target, frame);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+
+    Scene scene = create_main_scene();
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+
+    target.depth_format = DepthFormat::Float32;
+    double float_ms = frame_ms(scene, target, frame, frames);
+    std::vector<uint32_t> float_pixels = target.snapshot();
+
+    target.depth_format = DepthFormat::Fixed24;
+    double fixed_ms = frame_ms(scene, target, frame, frames);
+    std::vector<uint32_t> fixed_pixels = target.snapshot();
+
+    // fixed point rounds nearby depths to the same key, where the later triangle wins
+    int differing = 0;
+    for (size_t p = 0; p < float_pixels.size(); ++p)
+        differing += float_pixels[p] != fixed_pixels[p];
+
+    std::printf("main scene, %lld triangles\n", frame.stats.triangles);
+    std::printf("  float32: %8.2f ms/frame\n", float_ms);
+    std::printf("  fixed24: %8.2f ms/frame\n", fixed_ms);
+    std::printf("  %d of %zu pixels differ\n", differing, float_pixels.size());
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// saving a frame of the main scene in every format, checked against the decoder,
+// then what capturing costs the render thread when the writer does it instead
+// usage: bin/image_write_bench [frames] [directory]
+
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// decodes the file and compares it with the frame; decoded rows are bottom first, in RGBA8
+bool round_trip(const std::string &filename, const RenderTarget &target)
+{
+    DecodedImage image = decode_image(filename);
+    if (image.width != target.width || image.height != target.height)
+        return false;
+    for (int y = 0; y < target.height; ++y)
+        for (int x = 0; x < target.width; ++x)
+        {
+            vec3r color = target.color(x, y);
+            if ((image.pixels[static_cast<size_t>(y) * image.width + x] & 0xFFFFFF) != pack_texel(color.x(), color.y(), color.z(), 0))
+                return false;
+        }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+    std::string directory = argc > 2 ? argv[2] : "/tmp";
+
+    Scene scene = create_main_scene();
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+    target.clearDepth();
+    target.clearPixels(vector3(135, 206, 235));
+    render_scene(scene, target, frame);
+
+    std::printf("rgb conversion: %s\n", rgb_converter().name);
+    const char *names[] = {"bmp", "png", "png-stored"};
+    ImageFormat formats[] = {ImageFormat::BMP, ImageFormat::PNG, ImageFormat::PNGStored};
+    ImageEncoder encoder;
+    for (int f = 0; f < 3; ++f)
+    {
+        std::string filename = directory + "/image_write_bench" + (f == 2 ? "_stored" : "") + image_extension(formats[f]);
+        encoder.write(filename, formats[f], target); // warm up the buffers
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i)
+            encoder.write(filename, formats[f], target);
+        double ms = elapsed_ms(start) / frames;
+
+        std::FILE *file = std::fopen(filename.c_str(), "rb");
+        std::fseek(file, 0, SEEK_END);
+        long size = std::ftell(file);
+        std::fclose(file);
+        std::printf("  %-10s %7.2f ms/frame, %7.1f KB, round trip %s\n", names[f], ms, size / 1024.0,
+                    round_trip(filename, target) ? "ok" : "MISMATCH");
+    }
+
+    // rendering with every frame captured, against rendering alone
+    for (int f = 0; f < 3; ++f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i)
+            render_scene(scene, target, frame);
+        double render_ms = elapsed_ms(start) / frames;
+
+        ImageWriter writer;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i)
+        {
+            render_scene(scene, target, frame);
+            char filename[200];
+            std::snprintf(filename, sizeof(filename), "%s/image_write_bench_%03d%s", directory.c_str(), i % 8, image_extension(formats[f]));
+            writer.submit(target, filename, formats[f]);
+        }
+        double captured_ms = elapsed_ms(start) / frames;
+        writer.flush();
+        std::printf("  %-10s render %6.2f ms/frame, capturing every frame %6.2f ms/frame (%.2f ms waiting for the writer), all written after %.2f ms/frame\n",
+                    names[f], render_ms, captured_ms, writer.wait_ms / frames, elapsed_ms(start) / frames);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// a 100 x 100 forest drawn from one instanced tree, then with coarser trees in the distance,
+// next to the same forest as 10k separate models
+// the three are measured in alternating rounds and each keeps its best, so none pays for going first
+// usage: bin/instancing_bench [frames] [rounds]
+
+double frame_ms(Scene &scene, RenderTarget &target, FrameContext &frame, int frames)
+{
+    render_scene(scene, target, frame); // warm up the buffers
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        scene.camera.transform.set_rotation(scene.camera.transform.yaw + degrees_to_radians(0.5), scene.camera.transform.pitch, 0);
+        render_scene(scene, target, frame);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 3;
+    const int side = 100;
+    const double spacing = 3;
+
+    Model tree = load_object("objects/tree.obj", "textures/colMap.bytes");
+    std::vector<Transform> transforms;
+    for (int z = 0; z < side; ++z)
+        for (int x = 0; x < side; ++x)
+            transforms.emplace_back(x * 0.7 + z * 1.3, 0, 0, vector3((x - side / 2) * spacing, 0, z * spacing + 4));
+
+    Camera camera(60.0, Transform(0, 0, 0, vector3(0, 3, -2)));
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+
+    Scene instanced({}, camera);
+    instanced.addInstanced(InstancedModel(tree, transforms));
+    // under 100 pixels across a tree is drawn from 4 x 4 x 4 cubes, under 40 from 3 x 3 x 3, under 8 not at all
+    Scene simplified({}, camera);
+    InstancedModel forest(tree, transforms);
+    auto near_lod = std::make_shared<const Mesh>(simplify_mesh(*tree.mesh, 4));
+    auto far_lod = std::make_shared<const Mesh>(simplify_mesh(*tree.mesh, 3));
+    forest.addLod(near_lod, 100);
+    forest.addLod(far_lod, 40);
+    forest.min_pixels = 8;
+    simplified.addInstanced(forest);
+    Scene separate({}, camera);
+    for (const Transform &transform : transforms)
+    {
+        Model copy = tree;
+        copy.transform = transform;
+        separate.addModel(copy);
+    }
+
+    double instanced_ms = 1e30, simplified_ms = 1e30, separate_ms = 1e30;
+    size_t visible = 0;
+    FrameStats lod_stats;
+    for (int round = 0; round < rounds; ++round)
+    {
+        instanced.camera = camera;
+        instanced_ms = std::min(instanced_ms, frame_ms(instanced, target, frame, frames));
+        visible = frame.draws.size();
+        simplified.camera = camera;
+        simplified_ms = std::min(simplified_ms, frame_ms(simplified, target, frame, frames));
+        lod_stats = frame.stats;
+        separate.camera = camera;
+        separate_ms = std::min(separate_ms, frame_ms(separate, target, frame, frames));
+    }
+
+    std::printf("%d trees, %d triangles each, %zu drawn after culling on the last frame\n",
+                side * side, tree.triangle_count(), visible);
+    std::printf("  instanced:       %8.2f ms/frame, %zu bytes per extra instance\n", instanced_ms, sizeof(mat4d));
+    std::printf("  with LODs:       %8.2f ms/frame, %d and %d triangle trees, %lld triangles simplified away and %d trees too small on the last frame\n",
+                simplified_ms, near_lod->triangle_count(), far_lod->triangle_count(), lod_stats.triangles_simplified, lod_stats.objects_small);
+    std::printf("  separate models: %8.2f ms/frame, %zu bytes per extra model\n", separate_ms, sizeof(Model));
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../include/object_loader.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+#include <algorithm>
+
+// .obj parsing throughput: the old getline / sscanf / split parser against the mapped from_chars parser
+// usage: bin/obj_load_bench [file.obj ...] (defaults to objects/*.obj)
+
+// the parser as it was, reading from memory so only the parsing is timed
+size_t legacy_parse(const std::string &text)
+{
+    auto split = [](const std::string &s, const std::string &delimiter)
+    {
+        size_t pos_start = 0, pos_end, delim_len = delimiter.length();
+        std::vector<std::string> res;
+        while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos)
+        {
+            res.push_back(s.substr(pos_start, pos_end - pos_start));
+            pos_start = pos_end + delim_len;
+        }
+        res.push_back(s.substr(pos_start));
+        return res;
+    };
+
+    std::vector<vec3r> points, normals;
+    std::vector<vec2r> uvs;
+    std::vector<int> point_indices;
+    std::istringstream file(text);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        double x, y, z;
+        if (line.rfind("v ", 0) == 0 && sscanf(line.c_str(), "v %lf %lf %lf", &x, &y, &z) == 3)
+            points.emplace_back(x, y, z);
+        else if (line.rfind("vt ", 0) == 0 && sscanf(line.c_str(), "vt %lf %lf", &x, &y) == 2)
+            uvs.emplace_back(x, y);
+        else if (line.rfind("vn ", 0) == 0 && sscanf(line.c_str(), "vn %lf %lf %lf", &x, &y, &z) == 3)
+            normals.emplace_back(x, y, z);
+        else if (line.rfind("f ", 0) == 0)
+        {
+            std::vector<std::string> tokens = split(line, " ");
+            std::string splitter = line.find("//") != std::string::npos ? "//" : "/";
+            std::vector<int> face;
+            for (size_t i = 1; i < tokens.size(); ++i)
+                face.push_back(std::stoi(split(tokens[i], splitter)[0]) - 1);
+            for (size_t i = 1; i + 1 < face.size(); ++i)
+                point_indices.insert(point_indices.end(), {face[0], face[i], face[i + 1]});
+        }
+    }
+    return point_indices.size() + points.size() + uvs.size() + normals.size();
+}
+
+template <typename F>
+double megabytes_per_second(size_t bytes, F &&fn)
+{
+    // repeat until about a quarter of a second has been measured
+    size_t repeats = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < 0.25)
+    {
+        fn();
+        ++repeats;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return bytes * repeats / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> paths(argv + 1, argv + argc);
+    if (paths.empty())
+    {
+        for (const auto &entry : std::filesystem::directory_iterator("objects"))
+            if (entry.path().extension() == ".obj")
+                paths.push_back(entry.path().string());
+        std::sort(paths.begin(), paths.end());
+    }
+
+    std::printf("%-24s %10s %12s %12s %12s %12s\n", "file", "KB", "legacy MB/s", "1 core MB/s", "chunked MB/s", "load ms");
+    size_t sink = 0;
+    for (const std::string &path : paths)
+    {
+        MappedFile file(path);
+        std::string text(file.view());
+        size_t bytes = file.length();
+
+        double legacy = megabytes_per_second(bytes, [&]()
+                                             { sink += legacy_parse(text); });
+        double single = megabytes_per_second(bytes, [&]()
+                                             { sink += parse_obj(file.view(), true, path, SIZE_MAX).point_indices.size(); });
+        // small chunks so even the bundled files exercise the parallel parse and merge
+        double chunked = megabytes_per_second(bytes, [&]()
+                                              { sink += parse_obj(file.view(), true, path, 64 * 1024).point_indices.size(); });
+
+        auto start = std::chrono::steady_clock::now();
+        Model model = load_object(path);
+        double load = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        sink += model.triangle_count();
+
+        std::printf("%-24s %10.1f %12.1f %12.1f %12.1f %12.2f\n", path.c_str(), bytes / 1024.0, legacy, single, chunked, load);
+    }
+    std::printf("(checksum %zu)\n", sink);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// a wall in front of a field of dragons, with and without occlusion culling
+// usage: bin/occlusion_bench [frames] [rows]
+
+double frame_ms(Scene &scene, RenderTarget &target, FrameContext &frame, int frames)
+{
+    render_scene(scene, target, frame); // warm up the buffers
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        render_scene(scene, target, frame);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+    int rows = argc > 2 ? std::atoi(argv[2]) : 6;
+
+    // the wall is a stretched cube, its own occluder; the dragons peek out on both sides
+    Model wall = load_object("objects/cube.obj", "textures/grass.bmp");
+    wall.transform = Transform(0, 0, 0, vector3(0, 1, 3), vector3(3, 2, 0.2));
+    wall.occluder = wall.mesh;
+    Model dragon = load_object("objects/dragon.obj", "_no_texture", vector3(80, 255, 200));
+    std::vector<Transform> transforms;
+    for (int z = 0; z < rows; ++z)
+        for (int x = -3; x <= 3; ++x)
+            transforms.emplace_back(0, 0, 0, vector3(x * 2.5, 0, 6 + z * 3.0));
+
+    Scene scene({}, Camera(60.0, Transform(0, 0, 0, vector3(0, 1, -1))));
+    scene.addModel(wall);
+    scene.addInstanced(InstancedModel(dragon, transforms));
+
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+    frame.occlusion.enabled = false;
+    double plain_ms = frame_ms(scene, target, frame, frames);
+    std::vector<uint32_t> plain_pixels = target.snapshot();
+    frame.occlusion.enabled = true;
+    double occlusion_ms = frame_ms(scene, target, frame, frames);
+
+    const FrameStats &stats = frame.stats;
+    std::printf("a wall in front of %zu dragons, %lld triangles\n", transforms.size(), stats.triangles);
+    std::printf("  frustum culling only: %8.2f ms/frame\n", plain_ms);
+    std::printf("  with occlusion:       %8.2f ms/frame, %d objects, %d clusters and %lld triangles (%.1f%%) occluded\n",
+                occlusion_ms, stats.objects_occluded, stats.clusters_occluded, stats.triangles_occluded, 100 * stats.occluded_fraction());
+    std::printf("  occluders:            %8.3f ms/frame for %lld triangles, culling %.3f ms/frame\n",
+                stats.occluder_ms, stats.occluder_triangles, stats.cull_ms);
+    bool same = plain_pixels == target.snapshot();
+    std::printf("  images %s\n", same ? "match" : "DIFFER");
+    return 0;
+}
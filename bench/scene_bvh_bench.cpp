@@ -0,0 +1,91 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// culling a 250 x 250 city of instanced buildings: the scene BVH against testing every instance's box
+// usage: bin/scene_bvh_bench [frames]
+
+template <typename F>
+double time_ms(int repeats, F &&body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+        body(r);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 100;
+    const int side = 250;
+    const double spacing = 4;
+
+    Model building = load_object("objects/cube.obj");
+    std::vector<Transform> transforms;
+    for (int z = 0; z < side; ++z)
+        for (int x = 0; x < side; ++x)
+            transforms.emplace_back(0, 0, 0, vector3((x - side / 2) * spacing, 0, (z - side / 2) * spacing),
+                                    vector3(1, 1 + (x * 7 + z * 13) % 5, 1));
+    Scene city({}, Camera(60.0, Transform(0, 0, 0, vector3(0, 3, 0))));
+    city.addInstanced(InstancedModel(building, transforms));
+    city.camera.far_plane = 200;
+
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+    std::vector<WorldBox> &boxes = frame.bvh.boxes;
+    boxes.resize(transforms.size());
+    auto update_boxes = [&]()
+    {
+        for (size_t i = 0; i < transforms.size(); ++i)
+            boxes[i] = world_box(building.mesh->bounds, transforms[i].get_matrix());
+    };
+    update_boxes();
+
+    double build_ms = time_ms(10, [&](int)
+                              { frame.bvh.build(); });
+    double refit_ms = time_ms(10, [&](int)
+                              { frame.bvh.refit(); });
+
+    // a camera turning on the spot, tested both ways
+    auto world_frustum = [&](int f)
+    {
+        city.camera.transform.set_rotation(degrees_to_radians(f * 3.6), 0, 0);
+        ViewSetup setup(city.camera, WIDTH, HEIGHT);
+        return setup.frustum.transformed(setup.view);
+    };
+    size_t linear_visible = 0, bvh_visible = 0;
+    double linear_ms = time_ms(frames, [&](int f)
+                               {
+                                   Frustum frustum = world_frustum(f);
+                                   linear_visible = 0;
+                                   for (const WorldBox &box : boxes)
+                                       linear_visible += frustum.test_box(box.min, box.max) != Visibility::Outside; });
+    int tested = 0;
+    double bvh_ms = time_ms(frames, [&](int f)
+                            {
+                                Frustum frustum = world_frustum(f);
+                                bvh_visible = 0;
+                                tested = 0;
+                                frame.bvh.query([&](const SceneBvh::Node &node, Visibility parent)
+                                                {
+                                                    ++tested;
+                                                    return parent == Visibility::Inside ? parent : frustum.test_box(node.box.min, node.box.max); },
+                                                [&](int, Visibility)
+                                                { ++bvh_visible; }); });
+
+    // the whole of collect_draws with every building moving a little each frame
+    double collect_ms = time_ms(frames, [&](int f)
+                                {
+                                    for (mat4d &matrix : city.instanced[0].matrices)
+                                        matrix.col[3][1] = 0.01 * (f % 10);
+                                    frame.stats.clear();
+                                    city.camera.transform.set_rotation(degrees_to_radians(f * 3.6), 0, 0);
+                                    collect_draws(city, WIDTH, HEIGHT, frame); });
+
+    std::printf("%zu instances, %zu BVH nodes\n", transforms.size(), frame.bvh.nodes.size());
+    std::printf("  build:          %8.3f ms\n", build_ms);
+    std::printf("  refit:          %8.3f ms\n", refit_ms);
+    std::printf("  linear cull:    %8.3f ms/frame, %zu visible on the last frame\n", linear_ms, linear_visible);
+    std::printf("  BVH cull:       %8.3f ms/frame, %zu visible, %d nodes tested\n", bvh_ms, bvh_visible, tested);
+    std::printf("  collect_draws:  %8.3f ms/frame with moving instances, %d draws\n", collect_ms, static_cast<int>(frame.draws.size()));
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include "../include/rasterizer.hpp"
+#include <chrono>
+#include <cstdio>
+
+// a tiled floor stretching to the horizon, with every texture filter
+// usage: bin/texture_bench [frames] [rows]
+
+double frame_ms(Scene &scene, RenderTarget &target, FrameContext &frame, int frames)
+{
+    render_scene(scene, target, frame); // warm up the buffers
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        render_scene(scene, target, frame);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : 30;
+    int rows = argc > 2 ? std::atoi(argv[2]) : 30;
+
+    // floor.obj is 10 units across with the whole texture on it
+    Model floor = load_object("objects/floor.obj", "textures/tile.bmp");
+    floor.cull = CullMode::None;
+    std::vector<Transform> transforms;
+    for (int z = 0; z < rows; ++z)
+        for (int x = -rows / 2; x <= rows / 2; ++x)
+            transforms.emplace_back(0, 0, 0, vector3(x * 10.0, 0, z * 10.0));
+
+    Scene scene({}, Camera(60.0, Transform(0, 0, 0, vector3(0, 2, -5))));
+    scene.addInstanced(InstancedModel(floor, transforms));
+
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+
+    const char *names[] = {"nearest", "bilinear", "trilinear"};
+    TextureFilter filters[] = {TextureFilter::Nearest, TextureFilter::Bilinear, TextureFilter::Trilinear};
+    std::printf("%zu floor tiles\n", transforms.size());
+    for (int f = 0; f < 3; ++f)
+    {
+        scene.instanced[0].shader.filter = filters[f];
+        double ms = frame_ms(scene, target, frame, frames);
+        std::printf("  %-10s %8.2f ms/frame, %lld pixels shaded\n", names[f], ms, frame.stats.raster.pixels_shaded);
+    }
+    return 0;
+}
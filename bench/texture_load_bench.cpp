@@ -0,0 +1,35 @@
+#include "../include/texture.hpp"
+#include <chrono>
+#include <cstdio>
+
+// texture load time: decoding the file, then building the mip chain
+// usage: bin/texture_load_bench [runs] [texture files...]
+
+int main(int argc, char *argv[])
+{
+    int runs = argc > 1 ? std::atoi(argv[1]) : 10;
+    std::vector<std::string> files;
+    for (int a = 2; a < argc; ++a)
+        files.push_back(argv[a]);
+    if (files.empty())
+        files = {"textures/grass.bmp", "textures/tile.bmp", "textures/daveTex.bytes", "textures/colMap.bytes", "textures/brick.png"};
+
+    for (const std::string &file : files)
+    {
+        auto start = std::chrono::steady_clock::now();
+        DecodedImage image;
+        for (int r = 0; r < runs; ++r)
+            image = decode_image(file);
+        double decode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < runs; ++r)
+            Texture texture(file);
+        double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+
+        double megapixels = static_cast<double>(image.width) * image.height / 1e6;
+        std::printf("%-24s %5d x %-5d decode %7.2f ms (%6.2f ms/MP), with mip maps %7.2f ms (%6.2f ms/MP)\n", file.c_str(),
+                    image.width, image.height, decode_ms, decode_ms / megapixels, load_ms, load_ms / megapixels);
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "../include/object_loader.hpp"
+#include "../include/vertex_stage.hpp"
+#include <chrono>
+#include <cstdio>
+
+// vertices per second through the old per-vertex projection and through the batched MVP path
+// usage: bin/transform_bench [file.obj] [iterations]
+
+// the per-vertex path as it was: Transform and Camera taken by value, the basis copied into a std::vector per call
+vector3 legacy_world_to_screen(const vector3 &point, Transform transform, Camera cam, int width, int height)
+{
+    std::vector<vector3> base_vectors = transform.get_base_vectors();
+    base_vectors[0] = base_vectors[0] * transform.scale.getX();
+    base_vectors[1] = base_vectors[1] * transform.scale.getY();
+    base_vectors[2] = base_vectors[2] * transform.scale.getZ();
+    vector3 vertex_world = Transform::transform(base_vectors, point) + transform.position;
+
+    std::vector<vector3> inverse_base_vectors = cam.transform.get_inverse_base_vectors();
+    vector3 vertex_view = Transform::transform(inverse_base_vectors, vertex_world - cam.transform.position);
+
+    double screen_height = tan(cam.fov / 2) * 2;
+    double pixels_per_unit = height / screen_height / vertex_view.getZ();
+    return vector3(vertex_view.getX() * pixels_per_unit + width / 2.0,
+                   vertex_view.getY() * pixels_per_unit + height / 2.0,
+                   vertex_view.getZ());
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = argc > 1 ? argv[1] : "objects/dragon.obj";
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 20;
+    const int width = 720, height = 480;
+
+    Model model = load_object(path);
+    model.transform = Transform(0.3, 0.1, 0, vector3(0, 0, 7));
+    Camera camera(60.0, Transform(0, 0, 0, vector3(0, 2, -2)));
+
+    std::vector<vector3> points;
+    for (const vec3r &p : model.mesh->positions)
+        points.emplace_back(p.x(), p.y(), p.z());
+    std::vector<vec4r> projected(model.mesh->positions.size());
+    size_t vertices = model.mesh->positions.size() * iterations;
+
+    double checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it)
+        for (const vector3 &p : points)
+            checksum += legacy_world_to_screen(p, model.transform, camera, width, height).getX();
+    double before = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it)
+    {
+        mat4r mvp = model_view_projection(model.transform, camera, width, height);
+        transform_points(mvp, model.mesh->positions, projected);
+        checksum -= projected[it % projected.size()].x();
+    }
+    double after = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%s: %zu vertices x %d\n", path.c_str(), model.mesh->positions.size(), iterations);
+    std::printf("  per-vertex world_to_screen: %8.2f Mverts/s\n", vertices / before / 1e6);
+    std::printf("  batched transform_points:   %8.2f Mverts/s (%.1fx)\n", vertices / after / 1e6, before / after);
+    std::printf("  (checksum %g)\n", checksum);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include "util.hpp"
+#include "mesh.hpp"
+#include "thread_pool.hpp"
+
+// ==================== AssetRegistry Class ====================
+// Meshes and textures keyed by path, loaded once and shared by every model that uses them.
+// Entries are weak, so an asset is freed with the last model holding it and loaded again if asked for after that.
+// Concurrent requests for the same key wait for the one load in flight instead of starting their own, running pool
+// tasks while they wait. A thread that is itself in the middle of a load never waits: a task it picked up while helping
+// the load along could be waiting on the very load below it on its own stack, so it loads its own copy instead.
+class AssetRegistry
+{
+public:
+    // `key` names the mesh and the options it was loaded with, `load` produces it on a miss
+    template <typename Load>
+    std::shared_ptr<const Mesh> mesh(const std::string &key, Load &&load)
+    {
+        return get(meshes, key, std::forward<Load>(load));
+    }
+
+    std::shared_ptr<const Texture> texture(const std::string &path)
+    {
+        return get(textures, path, [&]()
+                   { return std::make_shared<const Texture>(path); });
+    }
+
+    // assets currently alive
+    size_t mesh_count() { return live(meshes); }
+    size_t texture_count() { return live(textures); }
+
+private:
+    template <typename T>
+    struct Entry
+    {
+        std::weak_ptr<const T> asset;
+        std::shared_future<std::shared_ptr<const T>> loading; // valid while a load is in flight
+    };
+
+    template <typename T>
+    using Entries = std::unordered_map<std::string, Entry<T>>;
+
+    std::mutex lock;
+    Entries<Mesh> meshes;
+    Entries<Texture> textures;
+
+    static int &loads_on_this_thread()
+    {
+        thread_local int loads = 0;
+        return loads;
+    }
+
+    // marks the calling thread as loading for as long as it lives
+    struct LoadScope
+    {
+        LoadScope() { ++loads_on_this_thread(); }
+        ~LoadScope() { --loads_on_this_thread(); }
+    };
+
+    template <typename T, typename Load>
+    std::shared_ptr<const T> get(Entries<T> &entries, const std::string &key, Load &&load)
+    {
+        std::promise<std::shared_ptr<const T>> promise;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            Entry<T> &entry = entries[key];
+            if (auto asset = entry.asset.lock())
+                return asset;
+            if (entry.loading.valid() && loads_on_this_thread() > 0)
+            {
+                guard.unlock();
+                LoadScope scope;
+                return load();
+            }
+            if (entry.loading.valid())
+            {
+                auto loading = entry.loading;
+                guard.unlock();
+                while (loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                {
+                    if (!thread_pool().run_pending_task())
+                        std::this_thread::yield();
+                }
+                return loading.get();
+            }
+            entry.loading = promise.get_future().share();
+        }
+
+        std::shared_ptr<const T> asset;
+        try
+        {
+            LoadScope scope;
+            asset = load();
+        }
+        catch (...)
+        {
+            // waiters see the same error, the next request tries again
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> guard(lock);
+            entries[key].loading = {};
+            throw;
+        }
+        promise.set_value(asset);
+        std::lock_guard<std::mutex> guard(lock);
+        Entry<T> &entry = entries[key];
+        entry.asset = asset;
+        entry.loading = {};
+        return asset;
+    }
+
+    template <typename T>
+    size_t live(Entries<T> &entries)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t count = 0;
+        for (const auto &entry : entries)
+            count += !entry.second.asset.expired();
+        return count;
+    }
+};
+
+AssetRegistry &assets()
+{
+    static AssetRegistry registry;
+    return registry;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <utility>
+#include <cstdlib>
+#include <string>
+#include "vec.hpp"
+
+// how far past the screen edges a triangle may reach before it is clipped in x and y, in screen sizes
+// inside the band the clamped pixel bounds do the clipping, and edge functions of float coordinates stay precise
+const real GUARD_BAND = 1;
+
+// RASTERIZER_CLIPPING=0 drops triangles that need clipping instead, as binning did before there was a clipper
+inline bool clipping_enabled()
+{
+    const char *setting = std::getenv("RASTERIZER_CLIPPING");
+    return !setting || std::string(setting) != "0";
+}
+
+// a corner of a clipped triangle: its position in homogeneous screen space (x * w, y * w, w)
+// and its weights over the corners of the triangle it was cut from
+struct ClipVertex
+{
+    vec3r position;
+    vec3r weights;
+};
+
+// every plane cuts at most one more corner into a convex polygon: 3 corners and 5 planes
+const int MAX_CLIP_VERTICES = 8;
+
+struct ClipPolygon
+{
+    ClipVertex vertices[MAX_CLIP_VERTICES];
+    int count = 0;
+};
+
+// ==================== TriangleClipper Class ====================
+// Cuts triangles against the near plane, and against the guard band around the screen when they reach past it.
+// Works on the vertex stage's output and fixed size polygons, so clipping never allocates.
+class TriangleClipper
+{
+public:
+    real near = 0;
+    real band_min_x = 0, band_max_x = 0, band_min_y = 0, band_max_y = 0; // the guard band in screen pixels
+    bool enabled = clipping_enabled();
+
+    TriangleClipper() {}
+
+    TriangleClipper(int width, int height, real near_plane) { fit(width, height, near_plane); }
+
+    // sets the planes up for a screen size and near plane
+    void fit(int width, int height, real near_plane)
+    {
+        near = near_plane;
+        band_min_x = -width * GUARD_BAND;
+        band_max_x = width * (1 + GUARD_BAND);
+        band_min_y = -height * GUARD_BAND;
+        band_max_y = height * (1 + GUARD_BAND);
+        // a point (x, y, w) is inside a plane (a, b, c, d) when a * x + b * y + c * w + d >= 0
+        planes[0] = vec4r(0, 0, 1, -near);
+        planes[1] = vec4r(1, 0, -band_min_x, 0);
+        planes[2] = vec4r(-1, 0, band_max_x, 0);
+        planes[3] = vec4r(0, 1, -band_min_y, 0);
+        planes[4] = vec4r(0, -1, band_max_y, 0);
+    }
+
+    // whether a triangle needs no clipping; `min_x` .. `max_y` are its screen bounds, meaningless unless every corner is
+    // in front of the near plane
+    bool inside(const vec4r &a, const vec4r &b, const vec4r &c, real min_x, real max_x, real min_y, real max_y) const
+    {
+        return a.z() >= near && b.z() >= near && c.z() >= near &&
+               min_x >= band_min_x && max_x <= band_max_x && min_y >= band_min_y && max_y <= band_max_y;
+    }
+
+    // whether clipping would leave nothing of a triangle: it's wholly behind the near plane,
+    // or wholly in front of it and past one side of the guard band
+    bool outside(const vec4r &a, const vec4r &b, const vec4r &c, real min_x, real max_x, real min_y, real max_y) const
+    {
+        if (a.z() < near && b.z() < near && c.z() < near)
+            return true;
+        return a.z() >= near && b.z() >= near && c.z() >= near &&
+               (max_x < band_min_x || min_x > band_max_x || max_y < band_min_y || min_y > band_max_y);
+    }
+
+    // clips a triangle given as vertex stage output (screen x, screen y, view depth, 1 / view depth)
+    // returns the number of corners left in `out`, fewer than 3 when nothing is left
+    int clip(const vec4r &a, const vec4r &b, const vec4r &c, ClipPolygon &out) const
+    {
+        ClipPolygon scratch;
+        ClipPolygon *from = &out, *to = &scratch;
+        from->vertices[0] = ClipVertex{homogeneous(a), vec3r(1, 0, 0)};
+        from->vertices[1] = ClipVertex{homogeneous(b), vec3r(0, 1, 0)};
+        from->vertices[2] = ClipVertex{homogeneous(c), vec3r(0, 0, 1)};
+        from->count = 3;
+
+        for (const vec4r &plane : planes)
+        {
+            real distance[MAX_CLIP_VERTICES];
+            int outside = 0;
+            for (int v = 0; v < from->count; ++v)
+            {
+                const vec3r &p = from->vertices[v].position;
+                distance[v] = plane.x() * p.x() + plane.y() * p.y() + plane.z() * p.z() + plane.w();
+                outside += distance[v] < 0;
+            }
+            if (outside == 0)
+                continue;
+            if (outside == from->count)
+                return out.count = 0;
+
+            // Sutherland-Hodgman: keep the corners inside, add a corner wherever an edge crosses the plane
+            to->count = 0;
+            for (int v = 0; v < from->count; ++v)
+            {
+                int next = v + 1 < from->count ? v + 1 : 0;
+                const ClipVertex &current = from->vertices[v];
+                if (distance[v] >= 0)
+                    to->vertices[to->count++] = current;
+                if ((distance[v] < 0) != (distance[next] < 0))
+                {
+                    const ClipVertex &other = from->vertices[next];
+                    real t = distance[v] / (distance[v] - distance[next]);
+                    to->vertices[to->count++] = ClipVertex{lerp(current.position, other.position, t), lerp(current.weights, other.weights, t)};
+                }
+            }
+            std::swap(from, to);
+        }
+        if (from != &out)
+            out = *from;
+        return out.count;
+    }
+
+    // a clipped corner back in the vertex stage's layout
+    static vec4r project(const vec3r &p)
+    {
+        real inverse_w = 1 / p.z();
+        return vec4r(p.x() * inverse_w, p.y() * inverse_w, p.z(), inverse_w);
+    }
+
+private:
+    vec4r planes[5];
+
+    // transform_points divides only points in front of the camera
+    static vec3r homogeneous(const vec4r &p)
+    {
+        if (p.z() > 0)
+            return vec3r(p.x() * p.z(), p.y() * p.z(), p.z());
+        return vec3r(p.x(), p.y(), p.z());
+    }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+// what the Hi-Z tests and the shading did while rendering one tile
+struct RasterStats
+{
+    long long triangles_hidden = 0; // rejected whole before edge setup
+    long long blocks_hidden = 0;    // 8x8 blocks of a triangle skipped without a depth test
+    long long blocks_accepted = 0;  // 8x8 blocks of a triangle drawn without reading the depth buffer
+    long long pixels_shaded = 0;    // shader calls; more than the pixels drawn when forward shading overdraws
+};
+
+// what triangle setup rejected on one binning worker
+struct SetupStats
+{
+    long long culled = 0;     // facing away, per the draw's cull mode
+    long long degenerate = 0; // zero area on the screen
+    long long missed = 0;     // covering no pixel centre
+    long long dropped = 0;    // needing clipping with the clipper off
+};
+
+// ==================== FrameStats Class ====================
+// What render_scene did with the last frame. Objects are models and instances.
+struct FrameStats
+{
+    int objects = 0, objects_culled = 0;
+    int clusters = 0, clusters_culled = 0; // clusters of objects that were only partly in view or partly occluded
+    long long triangles = 0, triangles_culled = 0;
+    // the part of the culled counts the occlusion buffer is responsible for
+    int objects_occluded = 0, clusters_occluded = 0;
+    long long triangles_occluded = 0;
+    // instances below their model's min_pixels, also part of the culled counts,
+    // and triangles saved by drawing coarser meshes, which are not
+    int objects_small = 0;
+    long long triangles_simplified = 0;
+    int occluders = 0;              // objects drawn into the occlusion buffer
+    long long occluder_triangles = 0;
+    double occluder_ms = 0, cull_ms = 0; // drawing the occluders, and all of collect_draws including that
+    double bin_ms = 0;                   // assembling, clipping, setting up and binning the triangles
+    long long triangles_clipped = 0;     // pieces binned from triangles cut by the near plane or the guard band
+    int bvh_nodes_tested = 0; // scene BVH nodes tested against the frustum
+    SetupStats setup;         // summed over all workers
+    RasterStats raster;       // summed over all tiles
+
+    void clear() { *this = FrameStats(); }
+
+    void add(const SetupStats &worker)
+    {
+        setup.culled += worker.culled;
+        setup.degenerate += worker.degenerate;
+        setup.missed += worker.missed;
+        setup.dropped += worker.dropped;
+    }
+
+    void add(const RasterStats &tile)
+    {
+        raster.triangles_hidden += tile.triangles_hidden;
+        raster.blocks_hidden += tile.blocks_hidden;
+        raster.blocks_accepted += tile.blocks_accepted;
+        raster.pixels_shaded += tile.pixels_shaded;
+    }
+
+    double culled_fraction() const { return triangles ? double(triangles_culled) / triangles : 0; }
+    double occluded_fraction() const { return triangles ? double(triangles_occluded) / triangles : 0; }
+};
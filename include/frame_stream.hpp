@@ -0,0 +1,226 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+enum class VideoFormat
+{
+    Y4M, // YUV4MPEG2, 4:2:0 BT.601, what ffmpeg and most encoders read from a pipe
+    RGBA // raw R, G, B, A bytes, e.g. ffmpeg -f rawvideo -pix_fmt rgba -s WxH -i -
+};
+
+// "y4m" or "rgba"; returns false for anything else
+inline bool parse_video_format(const std::string &name, VideoFormat &format)
+{
+    if (name == "y4m")
+        format = VideoFormat::Y4M;
+    else if (name == "rgba")
+        format = VideoFormat::RGBA;
+    else
+        return false;
+    return true;
+}
+
+// ==================== FrameStream Class ====================
+// Writes ARGB8888 frames, top row first, as a video stream to a file or stdout.
+// Frames are rendered straight into buffers the stream owns: acquire() hands out a free one and submit() queues it.
+// A thread of its own converts and writes queued frames, so frame k is written while frame k + 1 renders,
+// and acquire() only waits when every buffer is still queued, i.e. when writing is the slower side.
+class FrameStream
+{
+public:
+    // `out` stays open after the stream is done with it; nothing is written if it's null
+    FrameStream(std::FILE *out, VideoFormat format, int width, int height, int fps, int buffer_count = 2)
+        : out(out), format(format), width(width), height(height)
+    {
+        frames.resize(buffer_count);
+        for (std::vector<uint32_t> &frame : frames)
+        {
+            frame.resize(static_cast<size_t>(width) * height);
+            free_frames.push_back(frame.data());
+        }
+        if (format == VideoFormat::Y4M)
+        {
+            // C420jpeg: chroma sited between the four luma samples it covers, so it's their plain average
+            char header[100];
+            int length = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+            failed = !write(header, length);
+            encoded.resize(6 + static_cast<size_t>(width) * height + 2 * chroma_size());
+        }
+        else
+            encoded.resize(static_cast<size_t>(width) * height * 4);
+        writer = std::thread(&FrameStream::write_loop, this);
+    }
+
+    ~FrameStream() { finish(); }
+
+    FrameStream(const FrameStream &) = delete;
+    FrameStream &operator=(const FrameStream &) = delete;
+
+    // a buffer for the next frame, width pixels per row; waits for one to be written if none is free
+    // null once writing has failed
+    uint32_t *acquire()
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]()
+                     { return !free_frames.empty() || failed; });
+        wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (failed)
+            return nullptr;
+        uint32_t *frame = free_frames.front();
+        free_frames.pop_front();
+        return frame;
+    }
+
+    // queues a frame from acquire() to be written
+    void submit(uint32_t *frame)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queued.push_back(frame);
+        }
+        changed.notify_all();
+    }
+
+    // writes everything queued and stops the writer; returns whether every frame was written
+    bool finish()
+    {
+        if (writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            changed.notify_all();
+            writer.join();
+            if (out && std::fflush(out) != 0)
+                failed = true;
+        }
+        return !failed;
+    }
+
+    // totals, read once the stream is finished
+    int frames_written = 0;
+    double wait_ms = 0;   // spent in acquire() waiting for a free buffer
+    double encode_ms = 0; // converting frames on the writer thread
+    double write_ms = 0;  // writing them out
+
+private:
+    std::FILE *out;
+    VideoFormat format;
+    int width, height;
+    std::vector<std::vector<uint32_t>> frames;
+    std::vector<uint8_t> encoded; // the frame being written, as it goes out
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<uint32_t *> free_frames, queued;
+    bool stopping = false;
+    bool failed = false;
+    std::thread writer;
+
+    size_t chroma_size() const { return static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2); }
+
+    bool write(const void *data, size_t size)
+    {
+        return !out || std::fwrite(data, 1, size, out) == size;
+    }
+
+    void write_loop()
+    {
+        while (true)
+        {
+            uint32_t *frame;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]()
+                             { return !queued.empty() || stopping; });
+                if (queued.empty())
+                    return;
+                frame = queued.front();
+                queued.pop_front();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            if (format == VideoFormat::Y4M)
+                encode_y4m(frame);
+            else
+                encode_rgba(frame);
+            auto encoded_at = std::chrono::steady_clock::now();
+            bool written = write(encoded.data(), encoded.size());
+            encode_ms += std::chrono::duration<double, std::milli>(encoded_at - start).count();
+            write_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encoded_at).count();
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                free_frames.push_back(frame);
+                if (written)
+                    ++frames_written;
+                else
+                    failed = true;
+            }
+            changed.notify_all();
+            if (!written)
+                return;
+        }
+    }
+
+    // little-endian ARGB8888 is B, G, R, A in memory; swap red and blue
+    void encode_rgba(const uint32_t *frame)
+    {
+        uint32_t *to = reinterpret_cast<uint32_t *>(encoded.data());
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+        {
+            uint32_t pixel = frame[i];
+            to[i] = (pixel & 0xFF00FF00) | ((pixel >> 16) & 255) | ((pixel & 255) << 16);
+        }
+    }
+
+    // BT.601 studio range in 8-bit fixed point
+    static uint8_t luma(int r, int g, int b) { return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); }
+    static uint8_t chroma_blue(int r, int g, int b) { return static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128); }
+    static uint8_t chroma_red(int r, int g, int b) { return static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128); }
+
+    void encode_y4m(const uint32_t *frame)
+    {
+        std::memcpy(encoded.data(), "FRAME\n", 6);
+        uint8_t *y_plane = encoded.data() + 6;
+        uint8_t *u_plane = y_plane + static_cast<size_t>(width) * height;
+        uint8_t *v_plane = u_plane + chroma_size();
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+        {
+            uint32_t pixel = frame[i];
+            y_plane[i] = luma((pixel >> 16) & 255, (pixel >> 8) & 255, pixel & 255);
+        }
+
+        // each chroma sample from the average colour of a 2x2 block, edges repeated for odd sizes
+        int chroma_width = (width + 1) / 2;
+        for (int y = 0; y < (height + 1) / 2; ++y)
+        {
+            const uint32_t *row0 = frame + static_cast<size_t>(2 * y) * width;
+            const uint32_t *row1 = frame + static_cast<size_t>(std::min(2 * y + 1, height - 1)) * width;
+            for (int x = 0; x < chroma_width; ++x)
+            {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, width - 1);
+                uint32_t a = row0[x0], b = row0[x1], c = row1[x0], d = row1[x1];
+                // red and blue summed side by side in one word, green in another; four 8-bit values fit in 10 bits
+                uint32_t red_blue = (a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002;
+                uint32_t green = (a & 0xFF00) + (b & 0xFF00) + (c & 0xFF00) + (d & 0xFF00) + 0x200;
+                int r = (red_blue >> 18) & 255, g = (green >> 10) & 255, bl = (red_blue >> 2) & 255;
+                size_t index = static_cast<size_t>(y) * chroma_width + x;
+                u_plane[index] = chroma_blue(r, g, bl);
+                v_plane[index] = chroma_red(r, g, bl);
+            }
+        }
+    }
+};
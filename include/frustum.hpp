@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cmath>
+#include "vec.hpp"
+#include "mesh.hpp"
+#include "util.hpp"
+
+enum class Visibility
+{
+    Outside,
+    Intersecting,
+    Inside
+};
+
+// ==================== Frustum Class ====================
+// Six planes (a, b, c, d), a point p is inside a plane when a * p.x + b * p.y + c * p.z + d >= 0.
+// Order: left, right, bottom, top, near, far. Planes are kept normalized so the value is a distance.
+class Frustum
+{
+public:
+    vec4d planes[6];
+
+    Frustum() {}
+
+    // view space frustum of a camera rendering a width x height image
+    // the camera looks down +z with x right and y up; the vertical field of view is cam.fov
+    static Frustum from_camera(const Camera &cam, int width, int height)
+    {
+        double tan_y = std::tan(cam.fov / 2);
+        double tan_x = tan_y * width / height;
+        Frustum frustum;
+        frustum.planes[0] = vec4d(1.0, 0.0, tan_x, 0.0);
+        frustum.planes[1] = vec4d(-1.0, 0.0, tan_x, 0.0);
+        frustum.planes[2] = vec4d(0.0, 1.0, tan_y, 0.0);
+        frustum.planes[3] = vec4d(0.0, -1.0, tan_y, 0.0);
+        frustum.planes[4] = vec4d(0.0, 0.0, 1.0, -cam.near_plane);
+        frustum.planes[5] = vec4d(0.0, 0.0, -1.0, cam.far_plane);
+        frustum.normalize_planes();
+        return frustum;
+    }
+
+    // the same frustum in the space that `to_here` maps into this frustum's space
+    // e.g. pass the model-view matrix to get the frustum in model space, where mesh bounds can be tested directly
+    Frustum transformed(const mat4d &to_here) const
+    {
+        // planes are covectors: p . (M q) = (M^T p) . q
+        mat4d transpose = to_here.transpose();
+        Frustum frustum;
+        for (int i = 0; i < 6; ++i)
+            frustum.planes[i] = transpose * planes[i];
+        frustum.normalize_planes();
+        return frustum;
+    }
+
+    Visibility test_sphere(const vec3r &center, real radius) const
+    {
+        Visibility result = Visibility::Inside;
+        for (const vec4d &plane : planes)
+        {
+            double distance = plane.x() * center.x() + plane.y() * center.y() + plane.z() * center.z() + plane.w();
+            if (distance < -radius)
+                return Visibility::Outside;
+            if (distance < radius)
+                result = Visibility::Intersecting;
+        }
+        return result;
+    }
+
+    Visibility test_box(const vec3r &min, const vec3r &max) const
+    {
+        Visibility result = Visibility::Inside;
+        for (const vec4d &plane : planes)
+        {
+            // the corners farthest along and against the plane's normal
+            double farthest = plane.w(), nearest = plane.w();
+            for (int k = 0; k < 3; ++k)
+            {
+                double low = plane[k] * min[k], high = plane[k] * max[k];
+                farthest += std::max(low, high);
+                nearest += std::min(low, high);
+            }
+            if (farthest < 0)
+                return Visibility::Outside;
+            if (nearest < 0)
+                result = Visibility::Intersecting;
+        }
+        return result;
+    }
+
+    // sphere first, the box only when the sphere straddles a plane
+    Visibility test(const Bounds &bounds) const
+    {
+        Visibility sphere = test_sphere(bounds.center, bounds.radius);
+        if (sphere != Visibility::Intersecting)
+            return sphere;
+        return test_box(bounds.min, bounds.max);
+    }
+
+private:
+    void normalize_planes()
+    {
+        for (vec4d &plane : planes)
+        {
+            double length = std::sqrt(plane.x() * plane.x() + plane.y() * plane.y() + plane.z() * plane.z());
+            if (length > 0)
+                plane = plane * (1 / length);
+        }
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include "vec.hpp"
+#include "util.hpp"
+#include "tile_binner.hpp"
+#include "render_target.hpp"
+
+const int HIZ_BLOCK = 8;  // pixels per side of a level 0 cell
+const int HIZ_LEVELS = 3; // 8x8, 16x16 and 32x32 cells, the last is one raster tile
+static_assert(TILE_SIZE == HIZ_BLOCK << (HIZ_LEVELS - 1), "the top Hi-Z level must match the raster tiles");
+
+// interpolated depths can stray a few ulps outside their corners' range, so corner depths are widened by this much
+// before they are encoded for the tests
+const real HIZ_DEPTH_MARGIN = real(1e-5);
+
+// RASTERIZER_HIZ=0 turns the Hi-Z tests off, for comparing against plain per-pixel depth tests
+inline bool hiz_enabled()
+{
+    const char *setting = std::getenv("RASTERIZER_HIZ");
+    return !setting || std::string(setting) != "0";
+}
+
+// ==================== HiZBuffer Class ====================
+// Nearest and farthest depth of square cells of the depth buffer, 8x8 pixels at level 0, doubling in size per level.
+// Both are conservative: `nearest` is never behind the cell's nearest pixel and `farthest` never in front of its farthest,
+// so a triangle behind `farthest` is hidden and one in front of `nearest` passes every depth test in the cell.
+// Bounds are depth buffer keys, so with reversed depth the nearest is the largest key and the farthest the smallest.
+// Cells never straddle raster tiles, so only the worker rendering a tile reads or writes that tile's cells.
+class HiZBuffer
+{
+public:
+    struct Level
+    {
+        int size, columns, rows;
+        std::vector<uint32_t> nearest, farthest;
+    };
+
+    Level levels[HIZ_LEVELS];
+    bool enabled = hiz_enabled(); // when off, every cell keeps bounds that never hide or accept anything
+
+    HiZBuffer(int width = 0, int height = 0)
+    {
+        for (int l = 0; l < HIZ_LEVELS; ++l)
+        {
+            Level &level = levels[l];
+            level.size = HIZ_BLOCK << l;
+            level.columns = (width + level.size - 1) / level.size;
+            level.rows = (height + level.size - 1) / level.size;
+            level.nearest.assign(level.columns * level.rows, UINT32_MAX);
+            level.farthest.assign(level.columns * level.rows, 0);
+        }
+    }
+
+    // reads the exact bounds of every cell in one raster tile back from the depth buffer
+    // a tile whose depth was just `cleared` holds nothing but the clear value, so there is nothing to read
+    void build_tile(const RenderTarget &target, int tile_x, int tile_y, bool cleared)
+    {
+        int blocks = TILE_SIZE / HIZ_BLOCK;
+        const Level &base = levels[0];
+        if (!enabled || cleared)
+        {
+            for (int l = 0; l < HIZ_LEVELS; ++l)
+            {
+                Level &level = levels[l];
+                int cells = TILE_SIZE / level.size;
+                for (int cy = tile_y * cells; cy < std::min((tile_y + 1) * cells, level.rows); ++cy)
+                    for (int cx = tile_x * cells; cx < std::min((tile_x + 1) * cells, level.columns); ++cx)
+                    {
+                        level.nearest[cy * level.columns + cx] = enabled ? 0 : UINT32_MAX;
+                        level.farthest[cy * level.columns + cx] = 0;
+                    }
+            }
+            return;
+        }
+        for (int by = tile_y * blocks; by < std::min((tile_y + 1) * blocks, base.rows); ++by)
+        {
+            for (int bx = tile_x * blocks; bx < std::min((tile_x + 1) * blocks, base.columns); ++bx)
+            {
+                uint32_t nearest = 0, farthest = UINT32_MAX;
+                for (int y = by * HIZ_BLOCK; y < std::min((by + 1) * HIZ_BLOCK, target.height); ++y)
+                {
+                    const uint32_t *row = &target.depth[get_index(0, y, target.width)];
+                    for (int x = bx * HIZ_BLOCK; x < std::min((bx + 1) * HIZ_BLOCK, target.width); ++x)
+                    {
+                        nearest = std::max(nearest, row[x]);
+                        farthest = std::min(farthest, row[x]);
+                    }
+                }
+                levels[0].nearest[by * base.columns + bx] = nearest;
+                levels[0].farthest[by * base.columns + bx] = farthest;
+            }
+        }
+        for (int l = 1; l < HIZ_LEVELS; ++l)
+        {
+            int cells = TILE_SIZE / levels[l].size;
+            for (int cy = tile_y * cells; cy < std::min((tile_y + 1) * cells, levels[l].rows); ++cy)
+                for (int cx = tile_x * cells; cx < std::min((tile_x + 1) * cells, levels[l].columns); ++cx)
+                    combine(l, cx, cy);
+        }
+    }
+
+    // whether every pixel of [min_x, max_x) x [min_y, max_y) is nearer than the depth key `depth`
+    // tests the finest level at which the rectangle touches no more than 2 x 2 cells
+    bool hides(int min_x, int min_y, int max_x, int max_y, uint32_t depth) const
+    {
+        for (int l = 0; l < HIZ_LEVELS; ++l)
+        {
+            const Level &level = levels[l];
+            int cx0 = min_x / level.size, cx1 = (max_x - 1) / level.size;
+            int cy0 = min_y / level.size, cy1 = (max_y - 1) / level.size;
+            if (l < HIZ_LEVELS - 1 && (cx1 - cx0 > 1 || cy1 - cy0 > 1))
+                continue;
+            for (int cy = cy0; cy <= cy1; ++cy)
+                for (int cx = cx0; cx <= cx1; ++cx)
+                    if (level.farthest[cy * level.columns + cx] <= depth)
+                        return false;
+            return true;
+        }
+        return false;
+    }
+
+    uint32_t nearest(int bx, int by) const { return levels[0].nearest[by * levels[0].columns + bx]; }
+    uint32_t farthest(int bx, int by) const { return levels[0].farthest[by * levels[0].columns + bx]; }
+
+    // new bounds for a level 0 block after drawing into it, passed up to the coarser levels
+    void update(int bx, int by, uint32_t nearest, uint32_t farthest)
+    {
+        if (!enabled)
+            return;
+        int index = by * levels[0].columns + bx;
+        levels[0].nearest[index] = nearest;
+        levels[0].farthest[index] = farthest;
+        for (int l = 1; l < HIZ_LEVELS; ++l)
+        {
+            bx /= 2;
+            by /= 2;
+            combine(l, bx, by);
+        }
+    }
+
+private:
+    // a cell's bounds from its (up to) four children
+    void combine(int l, int cx, int cy)
+    {
+        const Level &child = levels[l - 1];
+        uint32_t nearest = 0, farthest = UINT32_MAX;
+        for (int y = 2 * cy; y < std::min(2 * cy + 2, child.rows); ++y)
+        {
+            for (int x = 2 * cx; x < std::min(2 * cx + 2, child.columns); ++x)
+            {
+                nearest = std::max(nearest, child.nearest[y * child.columns + x]);
+                farthest = std::min(farthest, child.farthest[y * child.columns + x]);
+            }
+        }
+        Level &level = levels[l];
+        level.nearest[cy * level.columns + cx] = nearest;
+        level.farthest[cy * level.columns + cx] = farthest;
+    }
+};
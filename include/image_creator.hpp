@@ -2,67 +2,490 @@
 
 #include <string>
 #include <vector>
-#include <memory>
-#include <fstream>
+#include <array>
+#include <algorithm>
 #include <stdexcept>
-#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include "math.hpp"
-#include "util.h"
+#include "util.hpp"
+#include "render_target.hpp"
+#include "raster_kernel.hpp"
 
-#include "object_loader.hpp"
-#include "rasterizer.hpp"
+enum class ImageFormat
+{
+    BMP,      // 32-bit, rows written as they are in memory
+    PNG,      // RGB, deflated with a fast greedy matcher
+    PNGStored // RGB in uncompressed deflate blocks: larger files, next to no work
+};
 
-void write_image_to_file(Image image, const std::string &filename)
+// RASTERIZER_CAPTURE_FORMAT=bmp or png-stored picks how captured frames are saved, png otherwise
+inline ImageFormat capture_format_setting()
 {
-    std::string full_filename = filename + ".bmp";
-    u_int32_t header_size = 54;                                 // BMP header size
-    u_int32_t pixel_data_size = image.width * image.height * 3; // 3 bytes per pixel (RGB)
-    u_int32_t file_size = header_size + pixel_data_size;
-    std::vector<unsigned char> bmp_file(file_size);
-    unsigned char *bmp_data = bmp_file.data();
-    unsigned char *pixel_data = bmp_data + header_size;
+    const char *setting = std::getenv("RASTERIZER_CAPTURE_FORMAT");
+    if (setting && std::string(setting) == "bmp")
+        return ImageFormat::BMP;
+    if (setting && std::string(setting) == "png-stored")
+        return ImageFormat::PNGStored;
+    return ImageFormat::PNG;
+}
 
-    // https://en.wikipedia.org/wiki/BMP_file_format
-    // BMP header
-    bmp_data[0] = 'B';
-    bmp_data[1] = 'M';
-    *reinterpret_cast<u_int32_t *>(bmp_data + 2) = file_size;        // file size
-    *reinterpret_cast<u_int32_t *>(bmp_data + 10) = header_size;     // offset to pixel data
-    *reinterpret_cast<u_int32_t *>(bmp_data + 14) = 40;              // DIB header size
-    *reinterpret_cast<u_int32_t *>(bmp_data + 18) = image.width;     // image width
-    *reinterpret_cast<u_int32_t *>(bmp_data + 22) = image.height;    // image height
-    *reinterpret_cast<u_int16_t *>(bmp_data + 26) = 1;               // number of color planes
-    *reinterpret_cast<u_int16_t *>(bmp_data + 28) = 24;              // bits per pixel
-    *reinterpret_cast<u_int32_t *>(bmp_data + 30) = 0;               // compression (none)
-    *reinterpret_cast<u_int32_t *>(bmp_data + 34) = pixel_data_size; // size of pixel data
-    *reinterpret_cast<u_int32_t *>(bmp_data + 38) = 2835;            // horizontal resolution (72 DPI)
-    *reinterpret_cast<u_int32_t *>(bmp_data + 42) = 2835;            // vertical resolution (72 DPI)
-    *reinterpret_cast<u_int32_t *>(bmp_data + 46) = 0;               // number of colors in palette
-    *reinterpret_cast<u_int32_t *>(bmp_data + 50) = 0;               // important colors
-  
-    // fill the data
-    for (int j = 0; j < image.height; ++j)
+inline const char *image_extension(ImageFormat format)
+{
+    return format == ImageFormat::BMP ? ".bmp" : ".png";
+}
+
+// ARGB8888 pixels to R, G, B bytes; `to` needs 4 bytes to spare past the 3 * count it's given
+using RgbConverter = void (*)(const uint32_t *from, int count, uint8_t *to);
+
+struct RgbConverterInfo
+{
+    const char *name;
+    RgbConverter converter;
+};
+
+inline void argb_to_rgb_scalar(const uint32_t *from, int count, uint8_t *to)
+{
+    for (int i = 0; i < count; ++i, to += 3)
     {
-        for (int i = 0; i < image.width; ++i)
+        to[0] = static_cast<uint8_t>(from[i] >> 16);
+        to[1] = static_cast<uint8_t>(from[i] >> 8);
+        to[2] = static_cast<uint8_t>(from[i]);
+    }
+}
+
+#ifdef RASTERIZER_X86
+
+// four pixels at a time: one shuffle reorders B, G, R, A bytes to R, G, B and drops alpha, the 4 bytes of zeros
+// after them are overwritten by the next store
+__attribute__((target("ssse3"))) inline void argb_to_rgb_ssse3(const uint32_t *from, int count, uint8_t *to)
+{
+    const __m128i order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    int i = 0;
+    for (; i + 4 <= count; i += 4, to += 12)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(to), _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(from + i)), order));
+    argb_to_rgb_scalar(from + i, count - i, to);
+}
+
+#endif
+
+// the widest converter the CPU supports and simd_setting() allows; SSSE3 is past what sse2 allows
+inline RgbConverterInfo select_rgb_converter()
+{
+#ifdef RASTERIZER_X86
+    __builtin_cpu_init();
+    if (simd_setting() >= SimdLevel::AVX2 && __builtin_cpu_supports("ssse3"))
+        return {"ssse3", argb_to_rgb_ssse3};
+#endif
+    return {"scalar", argb_to_rgb_scalar};
+}
+
+inline const RgbConverterInfo &rgb_converter()
+{
+    static const RgbConverterInfo info = select_rgb_converter();
+    return info;
+}
+
+namespace encode_detail
+{
+    inline void put_u16_le(uint8_t *p, uint16_t v) { p[0] = v & 255, p[1] = v >> 8; }
+    inline void put_u32_le(uint8_t *p, uint32_t v) { p[0] = v & 255, p[1] = (v >> 8) & 255, p[2] = (v >> 16) & 255, p[3] = v >> 24; }
+    inline void put_u32_be(uint8_t *p, uint32_t v) { p[0] = v >> 24, p[1] = (v >> 16) & 255, p[2] = (v >> 8) & 255, p[3] = v & 255; }
+    inline void append_u32_be(std::vector<uint8_t> &out, uint32_t v)
+    {
+        out.insert(out.end(), {static_cast<uint8_t>(v >> 24), static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 8), static_cast<uint8_t>(v)});
+    }
+
+    inline const std::array<uint32_t, 256> &crc_table()
+    {
+        static const std::array<uint32_t, 256> table = []()
+        {
+            std::array<uint32_t, 256> t;
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k)
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                t[n] = c;
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    // start from 0, as PNG chunks do
+    inline uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        const std::array<uint32_t, 256> &table = crc_table();
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    inline uint32_t adler32(const uint8_t *data, size_t size)
+    {
+        uint32_t a = 1, b = 0;
+        while (size > 0)
+        {
+            size_t block = std::min<size_t>(size, 5552); // the most bytes before b could overflow 32 bits
+            for (size_t i = 0; i < block; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += block;
+            size -= block;
+        }
+        return (b << 16) | a;
+    }
+
+    // ==================== BitWriter Class ====================
+    // Appends a deflate bit stream to a byte vector, least significant bit first.
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t> &out) : out(out) {}
+
+        void put(uint32_t value, int count)
+        {
+            bits |= static_cast<uint64_t>(value) << pending;
+            pending += count;
+            if (pending >= 32)
+            {
+                uint8_t bytes[4];
+                put_u32_le(bytes, static_cast<uint32_t>(bits));
+                out.insert(out.end(), bytes, bytes + 4);
+                bits >>= 32;
+                pending -= 32;
+            }
+        }
+
+        // pads to a whole byte
+        void flush()
+        {
+            for (; pending > 0; pending -= 8, bits >>= 8)
+                out.push_back(static_cast<uint8_t>(bits));
+            pending = 0;
+        }
+
+    private:
+        std::vector<uint8_t> &out;
+        uint64_t bits = 0;
+        int pending = 0;
+    };
+
+    // deflate's fixed Huffman codes, bit-reversed to go out least significant bit first, with the length and
+    // distance codes of every length and distance
+    struct FixedCodes
+    {
+        uint16_t literal[288];
+        uint8_t literal_bits[288];
+        uint8_t distance[30];
+        uint8_t length_symbol[259]; // by match length, counted from 257
+        uint8_t distance_symbol[512]; // by distance - 1 below 256, 256 + (distance - 1) / 128 above
+
+        static const uint16_t length_base[29];
+        static const uint8_t length_extra[29];
+        static const uint16_t distance_base[30];
+        static const uint8_t distance_extra[30];
+
+        static uint32_t reverse(uint32_t code, int bits)
+        {
+            uint32_t reversed = 0;
+            for (int b = 0; b < bits; ++b, code >>= 1)
+                reversed = (reversed << 1) | (code & 1);
+            return reversed;
+        }
+
+        FixedCodes()
+        {
+            for (int s = 0; s < 288; ++s)
+            {
+                // 0-143: 8 bits from 0x30, 144-255: 9 bits from 0x190, 256-279: 7 bits from 0, 280-287: 8 bits from 0xC0
+                int bits = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+                uint32_t code = s < 144 ? 0x30 + s : s < 256 ? 0x190 + s - 144 : s < 280 ? s - 256 : 0xC0 + s - 280;
+                literal[s] = static_cast<uint16_t>(reverse(code, bits));
+                literal_bits[s] = static_cast<uint8_t>(bits);
+            }
+            for (int d = 0; d < 30; ++d)
+                distance[d] = static_cast<uint8_t>(reverse(d, 5));
+            for (int code = 0; code < 29; ++code)
+                for (int length = length_base[code]; length < length_base[code] + (1 << length_extra[code]) && length <= 258; ++length)
+                    length_symbol[length] = static_cast<uint8_t>(code);
+            length_symbol[258] = 28; // 258 has a code of its own, not 284 with all extra bits set
+            for (int code = 0; code < 30; ++code)
+                for (int d = distance_base[code]; d < distance_base[code] + (1 << distance_extra[code]); ++d)
+                    distance_symbol[d <= 256 ? d - 1 : 256 + ((d - 1) >> 7)] = static_cast<uint8_t>(code);
+        }
+    };
+
+    inline const uint16_t FixedCodes::length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    inline const uint8_t FixedCodes::length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    inline const uint16_t FixedCodes::distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                                           257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    inline const uint8_t FixedCodes::distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    inline const FixedCodes &fixed_codes()
+    {
+        static const FixedCodes codes;
+        return codes;
+    }
+
+    // ==================== Deflater Class ====================
+    // zlib streams made for speed over size: one block of fixed Huffman codes, matches found greedily through a
+    // hash of the next 3 bytes that remembers only the latest position, and nothing inside a match is hashed.
+    // Rendered frames are mostly runs and repeats of the row above (see the PNG filter), which this catches.
+    // The hash table is kept between calls.
+    class Deflater
+    {
+    public:
+        // appends the zlib stream of `data` to `out`; `stored` copies it in uncompressed blocks
+        void compress(const uint8_t *data, size_t size, bool stored, std::vector<uint8_t> &out)
+        {
+            out.push_back(0x78); // deflate, 32K window
+            out.push_back(0x01); // fastest, and the header's check bits
+            if (stored)
+                store(data, size, out);
+            else
+                deflate(data, size, out);
+            append_u32_be(out, adler32(data, size));
+        }
+
+    private:
+        static const int HASH_BITS = 15;
+        static const size_t WINDOW = 32768;
+        static const int MAX_MATCH = 258;
+        std::vector<uint32_t> head; // per hash, the latest position + 1, 0 for none
+
+        static uint32_t hash(const uint8_t *p)
+        {
+            uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+            return (v * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        // how many bytes from `a` and `b` agree, up to `limit`
+        static int match_length(const uint8_t *a, const uint8_t *b, int limit)
+        {
+            int n = 0;
+            for (; n + 8 <= limit; n += 8)
+            {
+                uint64_t x, y;
+                std::memcpy(&x, a + n, 8);
+                std::memcpy(&y, b + n, 8);
+                if (x != y)
+                    return n + __builtin_ctzll(x ^ y) / 8;
+            }
+            while (n < limit && a[n] == b[n])
+                ++n;
+            return n;
+        }
+
+        static void store(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+        {
+            size_t position = 0;
+            do
+            {
+                uint16_t length = static_cast<uint16_t>(std::min<size_t>(size - position, 65535));
+                uint8_t header[5];
+                header[0] = position + length == size; // final block flag, type 0
+                put_u16_le(header + 1, length);
+                put_u16_le(header + 3, static_cast<uint16_t>(~length));
+                out.insert(out.end(), header, header + 5);
+                out.insert(out.end(), data + position, data + position + length);
+                position += length;
+            } while (position < size);
+        }
+
+        void deflate(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+        {
+            const FixedCodes &codes = fixed_codes();
+            head.assign(size_t(1) << HASH_BITS, 0);
+            BitWriter bits(out);
+            bits.put(1 | (1 << 1), 3); // final block, fixed codes
+
+            auto literal = [&](uint8_t byte)
+            { bits.put(codes.literal[byte], codes.literal_bits[byte]); };
+
+            size_t i = 0;
+            while (i + 3 <= size)
+            {
+                uint32_t &slot = head[hash(data + i)];
+                size_t candidate = slot;
+                slot = static_cast<uint32_t>(i + 1);
+                if (candidate > 0 && i - (candidate - 1) <= WINDOW)
+                {
+                    size_t from = candidate - 1;
+                    int length = match_length(data + from, data + i, static_cast<int>(std::min<size_t>(MAX_MATCH, size - i)));
+                    if (length >= 3)
+                    {
+                        int length_code = codes.length_symbol[length];
+                        int symbol = 257 + length_code;
+                        bits.put(codes.literal[symbol], codes.literal_bits[symbol]);
+                        bits.put(length - FixedCodes::length_base[length_code], FixedCodes::length_extra[length_code]);
+                        size_t distance = i - from;
+                        int distance_code = codes.distance_symbol[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+                        bits.put(codes.distance[distance_code], 5);
+                        bits.put(static_cast<uint32_t>(distance - FixedCodes::distance_base[distance_code]), FixedCodes::distance_extra[distance_code]);
+                        i += length;
+                        continue;
+                    }
+                }
+                literal(data[i++]);
+            }
+            for (; i < size; ++i)
+                literal(data[i]);
+            bits.put(codes.literal[256], codes.literal_bits[256]); // end of block
+            bits.flush();
+        }
+    };
+
+    inline void write_or_throw(std::FILE *file, const void *data, size_t size, const std::string &filename)
+    {
+        if (std::fwrite(data, 1, size, file) != size)
+            throw std::runtime_error("Failed to write image: " + filename);
+    }
+}
+
+// ==================== ImageEncoder Class ====================
+// Saves ARGB8888 frames as BMP or PNG files. PNG rows are converted with rgb_converter() and filtered against the row
+// above (PNG's "up" filter), which turns flat and vertically repeating areas into zeros for the deflater.
+// The buffers stay allocated between images, so saving frame after frame at one size allocates nothing.
+class ImageEncoder
+{
+public:
+    // `pixels` top row first, rows `pitch` pixels apart; throws std::runtime_error if the file can't be written
+    void write(const std::string &filename, ImageFormat format, const uint32_t *pixels, int width, int height, size_t pitch)
+    {
+        std::FILE *file = std::fopen(filename.c_str(), "wb");
+        if (!file)
+            throw std::runtime_error("Failed to open file for writing: " + filename);
+        try
+        {
+            if (format == ImageFormat::BMP)
+                write_bmp(file, filename, pixels, width, height, pitch);
+            else
+                write_png(file, filename, pixels, width, height, pitch, format == ImageFormat::PNGStored);
+        }
+        catch (...)
         {
-            vector3 &pixel = image.pixels[get_index(i, j, image.width)];
-            unsigned char r = static_cast<unsigned char>(pixel.getX() * 255);
-            unsigned char g = static_cast<unsigned char>(pixel.getY() * 255);
-            unsigned char b = static_cast<unsigned char>(pixel.getZ() * 255);
-            pixel_data[(j * image.width + i) * 3 + 0] = b; // BGR format
-            pixel_data[(j * image.width + i) * 3 + 1] = g;
-            pixel_data[(j * image.width + i) * 3 + 2] = r;
+            std::fclose(file);
+            throw;
         }
+        if (std::fclose(file) != 0)
+            throw std::runtime_error("Failed to write image: " + filename);
+    }
+
+    void write(const std::string &filename, ImageFormat format, const RenderTarget &target)
+    {
+        write(filename, format, target.row(target.height - 1), target.width, target.height, target.pitch());
+    }
+
+private:
+    std::vector<uint8_t> filtered; // the PNG's rows, each after its filter byte
+    std::vector<uint8_t> row, previous_row;
+    std::vector<uint8_t> compressed;
+    encode_detail::Deflater deflater;
+
+    // https://en.wikipedia.org/wiki/BMP_file_format
+    // 32 bits per pixel are ARGB8888 in memory, so rows go out as they are, bottom row first
+    static void write_bmp(std::FILE *file, const std::string &filename, const uint32_t *pixels, int width, int height, size_t pitch)
+    {
+        using namespace encode_detail;
+        uint32_t header_size = 54;
+        uint32_t pixel_data_size = static_cast<uint32_t>(width) * height * 4;
+        uint8_t header[54] = {'B', 'M'};
+        put_u32_le(header + 2, header_size + pixel_data_size); // file size
+        put_u32_le(header + 10, header_size);                  // offset to pixel data
+        put_u32_le(header + 14, 40);                           // DIB header size
+        put_u32_le(header + 18, width);
+        put_u32_le(header + 22, height);
+        put_u16_le(header + 26, 1);  // color planes
+        put_u16_le(header + 28, 32); // bits per pixel
+        put_u32_le(header + 30, 0);  // no compression
+        put_u32_le(header + 34, pixel_data_size);
+        put_u32_le(header + 38, 2835); // horizontal resolution (72 DPI)
+        put_u32_le(header + 42, 2835); // vertical resolution (72 DPI)
+        write_or_throw(file, header, sizeof(header), filename);
+        for (int y = height - 1; y >= 0; --y)
+            write_or_throw(file, pixels + y * pitch, static_cast<size_t>(width) * 4, filename);
     }
 
-    FILE *file = fopen(full_filename.c_str(), "wb");
-    if (file)
+    void write_png(std::FILE *file, const std::string &filename, const uint32_t *pixels, int width, int height, size_t pitch, bool stored)
     {
-        fwrite(bmp_data, 1, file_size, file);
-        fclose(file);
+        using namespace encode_detail;
+        size_t row_size = static_cast<size_t>(width) * 3;
+        filtered.resize((row_size + 1) * height);
+        row.resize(row_size + 4); // the converter's slack
+        previous_row.assign(row_size + 4, 0);
+        RgbConverter convert = rgb_converter().converter;
+        for (int y = 0; y < height; ++y)
+        {
+            uint8_t *to = &filtered[(row_size + 1) * y];
+            if (stored)
+            {
+                // no filter, there's nothing to gain from one
+                to[0] = 0;
+                convert(pixels + y * pitch, width, row.data());
+                std::memcpy(to + 1, row.data(), row_size);
+                continue;
+            }
+            to[0] = 2; // up
+            convert(pixels + y * pitch, width, row.data());
+            for (size_t i = 0; i < row_size; ++i)
+                to[1 + i] = static_cast<uint8_t>(row[i] - previous_row[i]);
+            std::swap(row, previous_row);
+        }
+
+        compressed.clear();
+        deflater.compress(filtered.data(), filtered.size(), stored, compressed);
+
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        uint8_t ihdr[13];
+        put_u32_be(ihdr, width);
+        put_u32_be(ihdr + 4, height);
+        ihdr[8] = 8;  // bits per channel
+        ihdr[9] = 2;  // RGB
+        ihdr[10] = 0; // deflate
+        ihdr[11] = 0; // adaptive filters
+        ihdr[12] = 0; // not interlaced
+        write_or_throw(file, signature, sizeof(signature), filename);
+        write_chunk(file, filename, "IHDR", ihdr, sizeof(ihdr));
+        write_chunk(file, filename, "IDAT", compressed.data(), compressed.size());
+        write_chunk(file, filename, "IEND", nullptr, 0);
     }
-    else
+
+    static void write_chunk(std::FILE *file, const std::string &filename, const char *type, const uint8_t *data, size_t size)
     {
-        throw std::runtime_error("Failed to open file for writing: " + full_filename);
+        using namespace encode_detail;
+        uint8_t header[8];
+        put_u32_be(header, static_cast<uint32_t>(size));
+        std::memcpy(header + 4, type, 4);
+        uint32_t crc = crc32(crc32(0, header + 4, 4), data, size);
+        uint8_t footer[4];
+        put_u32_be(footer, crc);
+        write_or_throw(file, header, 8, filename);
+        if (size > 0)
+            write_or_throw(file, data, size, filename);
+        write_or_throw(file, footer, 4, filename);
     }
+};
+
+// saves one image as a BMP named `filename` + ".bmp"; colours are in 0..255, like everywhere in the renderer
+void write_image_to_file(Image image, const std::string &filename)
+{
+    std::vector<uint32_t> rows(static_cast<size_t>(image.width) * image.height);
+    for (int j = 0; j < image.height; ++j)
+        for (int i = 0; i < image.width; ++i)
+        {
+            const vec3r &pixel = image.pixels[get_index(i, j, image.width)];
+            vec3r clamped(std::clamp(pixel.x(), real(0), real(255)), std::clamp(pixel.y(), real(0), real(255)), std::clamp(pixel.z(), real(0), real(255)));
+            rows[static_cast<size_t>(image.height - 1 - j) * image.width + i] = pack_color(clamped); // top row first
+        }
+    ImageEncoder().write(filename + ".bmp", ImageFormat::BMP, rows.data(), image.width, image.height, image.width);
 }
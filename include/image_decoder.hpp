@@ -0,0 +1,539 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include "mapped_file.hpp"
+
+// RGBA8: one byte per channel, red in the low byte
+inline uint32_t pack_texel(int r, int g, int b, int a = 255)
+{
+    return static_cast<uint32_t>(r) | (static_cast<uint32_t>(g) << 8) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(a) << 24);
+}
+
+// an image file decoded to RGBA8 texels, row by row, row 0 being the one at v = 0 (the bottom, as in a BMP)
+struct DecodedImage
+{
+    int width = 0, height = 0;
+    std::vector<uint32_t> pixels;
+};
+
+namespace decode_detail
+{
+    inline uint16_t read_u16_le(const unsigned char *p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+    inline uint32_t read_u32_le(const unsigned char *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24); }
+    inline uint32_t read_u32_be(const unsigned char *p) { return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+    // ==================== Huffman Class ====================
+    // A canonical Huffman code as deflate writes them. Codes of up to FAST_BITS bits are decoded with one table lookup
+    // on the next bits of the stream, longer ones a bit at a time from the counts per length.
+    class Huffman
+    {
+    public:
+        static const int FAST_BITS = 10;
+        static const int MAX_BITS = 15;
+
+        uint16_t fast[1 << FAST_BITS]; // length << 9 | symbol, 0 for codes longer than FAST_BITS
+        uint16_t counts[MAX_BITS + 1];
+        uint16_t symbols[288]; // ordered by code
+
+        void build(const uint8_t *lengths, int n)
+        {
+            std::memset(fast, 0, sizeof(fast));
+            std::memset(counts, 0, sizeof(counts));
+            for (int s = 0; s < n; ++s)
+                counts[lengths[s]]++;
+            counts[0] = 0;
+
+            int offsets[MAX_BITS + 2] = {0};
+            int next_code[MAX_BITS + 1] = {0};
+            int code = 0;
+            for (int len = 1; len <= MAX_BITS; ++len)
+            {
+                offsets[len + 1] = offsets[len] + counts[len];
+                code = (code + counts[len - 1]) << 1;
+                next_code[len] = code;
+                if (counts[len] > (1 << len))
+                    throw std::runtime_error("Corrupt deflate stream: oversubscribed code");
+            }
+            for (int s = 0; s < n; ++s)
+            {
+                int len = lengths[s];
+                if (len == 0)
+                    continue;
+                symbols[offsets[len]++] = static_cast<uint16_t>(s);
+                int c = next_code[len]++;
+                if (len <= FAST_BITS)
+                {
+                    // the stream holds codes most significant bit first, the table is indexed by the bits as they come
+                    int reversed = 0;
+                    for (int b = 0; b < len; ++b)
+                        reversed |= ((c >> b) & 1) << (len - 1 - b);
+                    for (int i = reversed; i < (1 << FAST_BITS); i += 1 << len)
+                        fast[i] = static_cast<uint16_t>((len << 9) | s);
+                }
+            }
+        }
+    };
+
+    // ==================== Inflater Class ====================
+    // Decompresses a raw deflate stream (RFC 1951) into a buffer of known size.
+    class Inflater
+    {
+    public:
+        Inflater(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_size)
+            : in(in), in_size(in_size), out(out), out_size(out_size) {}
+
+        // returns the number of bytes written
+        size_t run()
+        {
+            bool last = false;
+            while (!last)
+            {
+                last = bits(1);
+                int type = bits(2);
+                if (type == 0)
+                    stored();
+                else if (type == 1)
+                    codes(fixed_lengths(), fixed_distances());
+                else if (type == 2)
+                {
+                    Huffman lengths, distances;
+                    dynamic(lengths, distances);
+                    codes(lengths, distances);
+                }
+                else
+                    throw std::runtime_error("Corrupt deflate stream: bad block type");
+            }
+            return written;
+        }
+
+    private:
+        const unsigned char *in;
+        size_t in_size, pos = 0;
+        unsigned char *out;
+        size_t out_size, written = 0;
+        uint64_t buffer = 0; // bits not consumed yet, the next one lowest
+        int count = 0;
+        int padding = 0; // zero bytes added past the end of the input
+
+        void refill()
+        {
+            while (count <= 56)
+            {
+                if (pos < in_size)
+                    buffer |= static_cast<uint64_t>(in[pos++]) << count;
+                else if (++padding > 8)
+                    throw std::runtime_error("Corrupt deflate stream: truncated");
+                count += 8;
+            }
+        }
+
+        // bits in the buffer that came from the input rather than from the padding
+        int input_bits() const { return count - 8 * padding; }
+
+        int bits(int n)
+        {
+            if (count < n)
+                refill();
+            int value = static_cast<int>(buffer & ((uint64_t(1) << n) - 1));
+            buffer >>= n;
+            count -= n;
+            return value;
+        }
+
+        int decode(const Huffman &huffman)
+        {
+            if (count < Huffman::MAX_BITS)
+                refill();
+            int entry = huffman.fast[buffer & ((1 << Huffman::FAST_BITS) - 1)];
+            if (entry)
+            {
+                buffer >>= entry >> 9;
+                count -= entry >> 9;
+                return entry & 511;
+            }
+            // canonical codes of one length are consecutive, so a code is found by how far it is past the first of its length
+            int code = 0, first = 0, index = 0;
+            for (int len = 1; len <= Huffman::MAX_BITS; ++len)
+            {
+                code |= bits(1);
+                int n = huffman.counts[len];
+                if (code - n < first)
+                    return huffman.symbols[index + (code - first)];
+                index += n;
+                first = (first + n) << 1;
+                code <<= 1;
+            }
+            throw std::runtime_error("Corrupt deflate stream: bad code");
+        }
+
+        void stored()
+        {
+            bits(count % 8); // to a byte boundary
+            int length = bits(16);
+            int complement = bits(16);
+            if ((length ^ 0xFFFF) != complement)
+                throw std::runtime_error("Corrupt deflate stream: bad stored block");
+            if (written + length > out_size)
+                throw std::runtime_error("Corrupt deflate stream: too much output");
+            // whole bytes left in the bit buffer come first, the rest is copied straight from the input
+            // padding sits above the input in the buffer and is only there once the input is used up, so a block
+            // longer than the input bytes buffered and unread would copy padding out as data
+            if (input_bits() < 0 || static_cast<size_t>(length) > input_bits() / 8 + (in_size - pos))
+                throw std::runtime_error("Corrupt deflate stream: truncated");
+            for (; length > 0 && count >= 8; --length)
+                out[written++] = static_cast<unsigned char>(bits(8));
+            std::memcpy(out + written, in + pos, length);
+            written += length;
+            pos += length;
+        }
+
+        void dynamic(Huffman &lengths, Huffman &distances)
+        {
+            static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+            int literal_count = bits(5) + 257;
+            int distance_count = bits(5) + 1;
+            int length_count = bits(4) + 4;
+            if (literal_count > 286 || distance_count > 30)
+                throw std::runtime_error("Corrupt deflate stream: too many codes");
+
+            uint8_t code_lengths[19] = {0};
+            for (int i = 0; i < length_count; ++i)
+                code_lengths[order[i]] = static_cast<uint8_t>(bits(3));
+            Huffman length_code;
+            length_code.build(code_lengths, 19);
+
+            uint8_t all[286 + 30] = {0};
+            int total = literal_count + distance_count;
+            for (int i = 0; i < total;)
+            {
+                int symbol = decode(length_code);
+                if (symbol < 16)
+                {
+                    all[i++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+                int repeat = 0;
+                uint8_t value = 0;
+                if (symbol == 16)
+                {
+                    if (i == 0)
+                        throw std::runtime_error("Corrupt deflate stream: repeat with nothing before");
+                    value = all[i - 1];
+                    repeat = 3 + bits(2);
+                }
+                else if (symbol == 17)
+                    repeat = 3 + bits(3);
+                else
+                    repeat = 11 + bits(7);
+                if (i + repeat > total)
+                    throw std::runtime_error("Corrupt deflate stream: too many lengths");
+                std::memset(all + i, value, repeat);
+                i += repeat;
+            }
+            lengths.build(all, literal_count);
+            distances.build(all + literal_count, distance_count);
+        }
+
+        void codes(const Huffman &lengths, const Huffman &distances)
+        {
+            static const uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+            static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            static const uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                                       257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+            static const uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+            while (true)
+            {
+                int symbol = decode(lengths);
+                if (symbol < 256)
+                {
+                    if (written == out_size)
+                        throw std::runtime_error("Corrupt deflate stream: too much output");
+                    out[written++] = static_cast<unsigned char>(symbol);
+                    continue;
+                }
+                if (symbol == 256)
+                    return;
+                symbol -= 257;
+                if (symbol >= 29)
+                    throw std::runtime_error("Corrupt deflate stream: bad length");
+                size_t length = length_base[symbol] + bits(length_extra[symbol]);
+                int distance_symbol = decode(distances);
+                if (distance_symbol >= 30)
+                    throw std::runtime_error("Corrupt deflate stream: bad distance");
+                size_t distance = distance_base[distance_symbol] + bits(distance_extra[distance_symbol]);
+                if (distance > written)
+                    throw std::runtime_error("Corrupt deflate stream: distance too far back");
+                if (written + length > out_size)
+                    throw std::runtime_error("Corrupt deflate stream: too much output");
+                // the copy may overlap what it writes, which repeats the last `distance` bytes
+                unsigned char *to = out + written;
+                const unsigned char *from = to - distance;
+                for (size_t i = 0; i < length; ++i)
+                    to[i] = from[i];
+                written += length;
+            }
+        }
+
+        static const Huffman &fixed_lengths()
+        {
+            static const Huffman huffman = []()
+            {
+                uint8_t lengths[288];
+                std::fill(lengths, lengths + 144, 8);
+                std::fill(lengths + 144, lengths + 256, 9);
+                std::fill(lengths + 256, lengths + 280, 7);
+                std::fill(lengths + 280, lengths + 288, 8);
+                Huffman h;
+                h.build(lengths, 288);
+                return h;
+            }();
+            return huffman;
+        }
+
+        static const Huffman &fixed_distances()
+        {
+            static const Huffman huffman = []()
+            {
+                uint8_t lengths[30];
+                std::fill(lengths, lengths + 30, 5);
+                Huffman h;
+                h.build(lengths, 30);
+                return h;
+            }();
+            return huffman;
+        }
+    };
+
+    inline int paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return a;
+        return pb <= pc ? b : c;
+    }
+}
+
+// a zlib stream (RFC 1950) inflated into `out`, which must be large enough; returns the bytes written
+inline size_t inflate_zlib(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_size)
+{
+    if (in_size < 2 || (in[0] & 15) != 8 || ((in[0] << 8) | in[1]) % 31 != 0 || (in[1] & 32))
+        throw std::runtime_error("Unsupported zlib stream");
+    return decode_detail::Inflater(in + 2, in_size - 2, out, out_size).run();
+}
+
+// 24 and 32 bit uncompressed BMPs, rows as they are in the file (bottom up unless the height is negative)
+inline DecodedImage decode_bmp(const unsigned char *data, size_t size, const std::string &name)
+{
+    using namespace decode_detail;
+    if (size < 54 || data[0] != 'B' || data[1] != 'M')
+        throw std::runtime_error("Not a BMP file: " + name);
+    uint32_t offset = read_u32_le(data + 10);
+    int32_t width = static_cast<int32_t>(read_u32_le(data + 18));
+    int32_t height = static_cast<int32_t>(read_u32_le(data + 22));
+    int bpp = read_u16_le(data + 28);
+    uint32_t compression = read_u32_le(data + 30);
+    if ((bpp != 24 && bpp != 32) || (compression != 0 && !(compression == 3 && bpp == 32)) || width <= 0 || height == 0)
+        throw std::runtime_error("Unsupported BMP format: " + name);
+    // 32 bit BMPs may give their channel masks; only the usual BGRA order is read
+    if (compression == 3 && (offset < 66 || read_u32_le(data + 54) != 0x00FF0000 || read_u32_le(data + 58) != 0x0000FF00 ||
+                             read_u32_le(data + 62) != 0x000000FF))
+        throw std::runtime_error("Unsupported BMP channel masks: " + name);
+    bool top_down = height < 0;
+    height = std::abs(height);
+
+    size_t row_size = ((static_cast<size_t>(bpp) * width + 31) / 32) * 4;
+    if (offset + row_size * height > size)
+        throw std::runtime_error("Truncated BMP file: " + name);
+
+    DecodedImage image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(static_cast<size_t>(width) * height);
+    int pixel_size = bpp / 8;
+    for (int y = 0; y < height; ++y)
+    {
+        const unsigned char *row = data + offset + row_size * y;
+        uint32_t *to = &image.pixels[static_cast<size_t>(top_down ? height - 1 - y : y) * width];
+        for (int x = 0; x < width; ++x, row += pixel_size)
+            to[x] = pack_texel(row[2], row[1], row[0], pixel_size == 4 ? row[3] : 255);
+    }
+    return image;
+}
+
+// the renderer's raw format: 16-bit width and height, then RGB bytes row by row
+inline DecodedImage decode_bytes(const unsigned char *data, size_t size, const std::string &name)
+{
+    using namespace decode_detail;
+    if (size < 4)
+        throw std::runtime_error("Truncated texture file: " + name);
+    DecodedImage image;
+    image.width = read_u16_le(data);
+    image.height = read_u16_le(data + 2);
+    size_t count = static_cast<size_t>(image.width) * image.height;
+    if (4 + count * 3 > size)
+        throw std::runtime_error("Truncated texture file: " + name);
+    image.pixels.resize(count);
+    const unsigned char *p = data + 4;
+    for (size_t i = 0; i < count; ++i, p += 3)
+        image.pixels[i] = pack_texel(p[0], p[1], p[2]);
+    return image;
+}
+
+// non-interlaced PNGs of every colour type, 8 or 16 bits per channel, or 1 to 8 bits per index or grey level
+// rows are flipped, a PNG stores its top row first
+inline DecodedImage decode_png(const unsigned char *data, size_t size, const std::string &name)
+{
+    using namespace decode_detail;
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (size < 8 || std::memcmp(data, signature, 8) != 0)
+        throw std::runtime_error("Not a PNG file: " + name);
+
+    int width = 0, height = 0, depth = 0, color_type = -1, interlace = 0;
+    uint32_t palette[256];
+    std::fill(palette, palette + 256, pack_texel(0, 0, 0));
+    std::vector<unsigned char> compressed;
+    for (size_t at = 8; at + 12 <= size;)
+    {
+        uint32_t length = read_u32_be(data + at);
+        const unsigned char *type = data + at + 4;
+        const unsigned char *chunk = data + at + 8;
+        if (length > size - at - 12)
+            throw std::runtime_error("Truncated PNG file: " + name);
+        if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13)
+        {
+            width = static_cast<int>(read_u32_be(chunk));
+            height = static_cast<int>(read_u32_be(chunk + 4));
+            depth = chunk[8];
+            color_type = chunk[9];
+            interlace = chunk[12];
+        }
+        else if (std::memcmp(type, "PLTE", 4) == 0)
+        {
+            for (uint32_t i = 0; i < std::min<uint32_t>(length / 3, 256); ++i)
+                palette[i] = pack_texel(chunk[3 * i], chunk[3 * i + 1], chunk[3 * i + 2]);
+        }
+        else if (std::memcmp(type, "tRNS", 4) == 0 && color_type == 3)
+        {
+            for (uint32_t i = 0; i < std::min<uint32_t>(length, 256); ++i)
+                palette[i] = (palette[i] & 0x00FFFFFF) | (static_cast<uint32_t>(chunk[i]) << 24);
+        }
+        else if (std::memcmp(type, "IDAT", 4) == 0)
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        else if (std::memcmp(type, "IEND", 4) == 0)
+            break;
+        at += 12 + length;
+    }
+
+    static const int channels_of[7] = {1, 0, 3, 1, 2, 0, 4};
+    if (width <= 0 || height <= 0 || color_type < 0 || color_type > 6 || channels_of[color_type] == 0)
+        throw std::runtime_error("Unsupported PNG format: " + name);
+    if (interlace != 0)
+        throw std::runtime_error("Interlaced PNGs are not supported: " + name);
+    int channels = channels_of[color_type];
+    bool valid_depth = depth == 8 || (depth == 16 && color_type != 3) || ((depth == 1 || depth == 2 || depth == 4) && (color_type == 0 || color_type == 3));
+    if (!valid_depth)
+        throw std::runtime_error("Unsupported PNG bit depth: " + name);
+
+    // every row is a filter type byte and the row's bytes; filters refer to the byte `step` to the left
+    size_t stride = (static_cast<size_t>(width) * channels * depth + 7) / 8;
+    int step = std::max(1, channels * depth / 8);
+    std::vector<unsigned char> raw(height * (stride + 1));
+    if (inflate_zlib(compressed.data(), compressed.size(), raw.data(), raw.size()) != raw.size())
+        throw std::runtime_error("Truncated PNG image data: " + name);
+
+    std::vector<unsigned char> previous(stride, 0);
+    DecodedImage image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y)
+    {
+        unsigned char *row = &raw[y * (stride + 1) + 1];
+        int filter = row[-1];
+        const unsigned char *up = y > 0 ? row - (stride + 1) : previous.data();
+        switch (filter)
+        {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = step; i < stride; ++i)
+                row[i] += row[i - step];
+            break;
+        case 2:
+            for (size_t i = 0; i < stride; ++i)
+                row[i] += up[i];
+            break;
+        case 3:
+            for (size_t i = 0; i < stride; ++i)
+                row[i] += ((i >= size_t(step) ? row[i - step] : 0) + up[i]) / 2;
+            break;
+        case 4:
+            for (size_t i = 0; i < stride; ++i)
+                row[i] += paeth(i >= size_t(step) ? row[i - step] : 0, up[i], i >= size_t(step) ? up[i - step] : 0);
+            break;
+        default:
+            throw std::runtime_error("Corrupt PNG row filter: " + name);
+        }
+
+        uint32_t *to = &image.pixels[static_cast<size_t>(height - 1 - y) * width];
+        if (depth < 8)
+        {
+            // packed indices or grey levels, first pixel in the high bits
+            int per_byte = 8 / depth, mask = (1 << depth) - 1, scale = 255 / mask;
+            for (int x = 0; x < width; ++x)
+            {
+                int value = (row[x / per_byte] >> ((per_byte - 1 - x % per_byte) * depth)) & mask;
+                to[x] = color_type == 3 ? palette[value] : pack_texel(value * scale, value * scale, value * scale);
+            }
+            continue;
+        }
+        int bytes = depth / 8; // 16-bit channels keep their high byte
+        const unsigned char *p = row;
+        for (int x = 0; x < width; ++x, p += channels * bytes)
+        {
+            switch (color_type)
+            {
+            case 0:
+                to[x] = pack_texel(p[0], p[0], p[0]);
+                break;
+            case 2:
+                to[x] = pack_texel(p[0], p[bytes], p[2 * bytes]);
+                break;
+            case 3:
+                to[x] = palette[p[0]];
+                break;
+            case 4:
+                to[x] = pack_texel(p[0], p[0], p[0], p[bytes]);
+                break;
+            default:
+                to[x] = pack_texel(p[0], p[bytes], p[2 * bytes], p[3 * bytes]);
+                break;
+            }
+        }
+    }
+    return image;
+}
+
+// maps the file and decodes it by its extension: .bmp, .png, or .bytes
+inline DecodedImage decode_image(const std::string &filename)
+{
+    std::string ext = filename.substr(filename.find_last_of(".") + 1);
+    if (ext != "bytes" && ext != "bmp" && ext != "png")
+        throw std::runtime_error("Unsupported texture format: " + filename);
+    MappedFile file(filename);
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(file.data());
+    if (ext == "bytes")
+        return decode_bytes(data, file.length(), filename);
+    if (ext == "bmp")
+        return decode_bmp(data, file.length(), filename);
+    return decode_png(data, file.length(), filename);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include "image_creator.hpp"
+#include "render_target.hpp"
+
+// ==================== ImageWriter Class ====================
+// Saves frames on a thread of its own, so capturing them doesn't hold up rendering.
+// submit() copies the frame into one of `capacity` buffers and returns; the writer thread encodes and writes them in
+// order. Only when every buffer is still queued does submit() wait for one, which bounds how much memory a disk
+// slower than the renderer can take up.
+class ImageWriter
+{
+public:
+    explicit ImageWriter(int capacity = 8)
+    {
+        jobs.resize(std::max(capacity, 1));
+        for (Job &job : jobs)
+            free_jobs.push_back(&job);
+        writer = std::thread(&ImageWriter::write_loop, this);
+    }
+
+    // writes whatever is still queued
+    ~ImageWriter()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        writer.join();
+    }
+
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    // queues the target's current colour to be saved as `filename`
+    void submit(const RenderTarget &target, const std::string &filename, ImageFormat format)
+    {
+        Job *job;
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&]()
+                         { return !free_jobs.empty(); });
+            wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            job = free_jobs.front();
+            free_jobs.pop_front();
+        }
+
+        job->width = target.width;
+        job->height = target.height;
+        job->filename = filename;
+        job->format = format;
+        job->pixels.resize(static_cast<size_t>(target.width) * target.height); // allocates only the first time
+        for (int y = 0; y < target.height; ++y)
+            std::memcpy(&job->pixels[static_cast<size_t>(target.height - 1 - y) * target.width], target.row(y), target.width * sizeof(uint32_t));
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queued.push_back(job);
+        }
+        changed.notify_all();
+    }
+
+    // waits until everything submitted so far is written
+    void flush()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]()
+                     { return queued.empty() && !writing; });
+    }
+
+    // images saved and images that failed, as of the last one the writer finished
+    int written() const { return written_count.load(); }
+    int failed() const { return failed_count.load(); }
+
+    double wait_ms = 0; // spent in submit() waiting for a free buffer, on the submitting thread
+
+private:
+    struct Job
+    {
+        std::vector<uint32_t> pixels; // top row first
+        int width = 0, height = 0;
+        std::string filename;
+        ImageFormat format = ImageFormat::PNG;
+    };
+
+    std::vector<Job> jobs;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<Job *> free_jobs, queued;
+    bool writing = false;
+    bool stopping = false;
+    std::atomic<int> written_count{0}, failed_count{0};
+    ImageEncoder encoder; // used by the writer thread only
+    std::thread writer;
+
+    void write_loop()
+    {
+        while (true)
+        {
+            Job *job;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]()
+                             { return !queued.empty() || stopping; });
+                if (queued.empty())
+                    return;
+                job = queued.front();
+                queued.pop_front();
+                writing = true;
+            }
+
+            try
+            {
+                encoder.write(job->filename, job->format, job->pixels.data(), job->width, job->height, job->width);
+                written_count.fetch_add(1);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << "\n";
+                failed_count.fetch_add(1);
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                free_jobs.push_back(job);
+                writing = false;
+            }
+            changed.notify_all();
+        }
+    }
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define RASTERIZER_MMAP
+#endif
+
+// ==================== MappedFile Class ====================
+// Read-only view of a whole file. Maps it where the platform allows, otherwise reads it into memory.
+class MappedFile
+{
+public:
+    MappedFile() {}
+
+    explicit MappedFile(const std::string &path)
+    {
+#ifdef RASTERIZER_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open file: " + path);
+        struct stat info;
+        if (::fstat(fd, &info) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Failed to stat file: " + path);
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size > 0)
+        {
+            void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Failed to map file: " + path);
+            }
+            ::madvise(mapping, size, MADV_SEQUENTIAL);
+            bytes = static_cast<const char *>(mapping);
+            mapped = true;
+        }
+        ::close(fd); // the mapping keeps its own reference
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file: " + path);
+        buffer.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(buffer.data(), buffer.size());
+        bytes = buffer.data();
+        size = buffer.size();
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept { swap(other); }
+    MappedFile &operator=(MappedFile &&other) noexcept
+    {
+        if (this != &other)
+        {
+            MappedFile old(std::move(*this));
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+#ifdef RASTERIZER_MMAP
+        if (mapped)
+            ::munmap(const_cast<char *>(bytes), size);
+#endif
+    }
+
+    const char *data() const { return bytes; }
+    size_t length() const { return size; }
+    std::string_view view() const { return std::string_view(bytes, size); }
+
+private:
+    const char *bytes = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    std::vector<char> buffer; // fallback when mapping isn't available
+
+    void swap(MappedFile &other) noexcept
+    {
+        std::swap(bytes, other.bytes);
+        std::swap(size, other.size);
+        std::swap(mapped, other.mapped);
+        std::swap(buffer, other.buffer);
+    }
+};
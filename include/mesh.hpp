@@ -0,0 +1,387 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include "vec.hpp"
+
+// axis-aligned box and bounding sphere around a set of points in model space
+struct Bounds
+{
+    vec3r min, max;
+    vec3r center;
+    real radius = 0;
+};
+
+// the sphere is centred on the box, with the radius of the farthest point rather than half the diagonal
+inline Bounds compute_bounds(std::span<const vec3r> points)
+{
+    if (points.empty())
+        return Bounds{};
+    Bounds bounds{points[0], points[0]};
+    for (const vec3r &p : points)
+    {
+        bounds.min = ::min(bounds.min, p);
+        bounds.max = ::max(bounds.max, p);
+    }
+    bounds.center = (bounds.min + bounds.max) * real(0.5);
+    real radius_squared = 0;
+    for (const vec3r &p : points)
+        radius_squared = std::max(radius_squared, dot(p - bounds.center, p - bounds.center));
+    bounds.radius = std::sqrt(radius_squared);
+    return bounds;
+}
+
+// triangles per cluster, the unit the renderer culls below whole meshes
+const int MESH_CLUSTER_TRIANGLES = 128;
+
+// a run of consecutive triangles with its own bounds
+// vertex_begin / vertex_end bound the vertices its triangles use, so a visible cluster only needs those transformed
+struct MeshCluster
+{
+    uint32_t first_triangle, triangle_count;
+    uint32_t vertex_begin, vertex_end;
+    Bounds bounds;
+};
+
+// owned vertex and index arrays, what the loader builds and the optimizers below rewrite
+struct MeshData
+{
+    std::vector<vec3r> positions;
+    std::vector<vec3r> normals;
+    std::vector<vec2r> uvs;
+    std::vector<uint32_t> indices; // three per triangle
+    std::vector<MeshCluster> clusters;
+
+    int vertex_count() const { return static_cast<int>(positions.size()); }
+    int triangle_count() const { return static_cast<int>(indices.size() / 3); }
+};
+
+// splits the triangles, in their current order, into clusters of MESH_CLUSTER_TRIANGLES
+// run it after the optimizers: their order keeps neighbouring triangles together, so the clusters stay compact
+std::vector<MeshCluster> build_clusters(const MeshData &mesh)
+{
+    std::vector<MeshCluster> clusters;
+    std::vector<vec3r> points;
+    for (int first = 0; first < mesh.triangle_count(); first += MESH_CLUSTER_TRIANGLES)
+    {
+        MeshCluster cluster;
+        cluster.first_triangle = first;
+        cluster.triangle_count = std::min(MESH_CLUSTER_TRIANGLES, mesh.triangle_count() - first);
+        cluster.vertex_begin = UINT32_MAX;
+        cluster.vertex_end = 0;
+        points.clear();
+        for (uint32_t c = first * 3; c < (first + cluster.triangle_count) * 3; ++c)
+        {
+            uint32_t vertex = mesh.indices[c];
+            cluster.vertex_begin = std::min(cluster.vertex_begin, vertex);
+            cluster.vertex_end = std::max(cluster.vertex_end, vertex + 1);
+            points.push_back(mesh.positions[vertex]);
+        }
+        cluster.bounds = compute_bounds(points);
+        clusters.push_back(cluster);
+    }
+    return clusters;
+}
+
+// ==================== Mesh Class ====================
+// Indexed triangle list. Vertex i is (positions[i], normals[i], uvs[i]); normals and uvs are empty when the source had none.
+// Attributes are stored as separate arrays so the vertex stage can stream them straight through transform_points.
+// The arrays are views into storage the mesh keeps alive: either its own MeshData or a mapped cache file.
+class Mesh
+{
+public:
+    std::span<const vec3r> positions;
+    std::span<const vec3r> normals;
+    std::span<const vec2r> uvs;
+    std::span<const uint32_t> indices;
+    std::span<const MeshCluster> clusters; // cover every triangle, in order
+    Bounds bounds;
+
+    Mesh() {}
+
+    explicit Mesh(MeshData data)
+    {
+        auto owned = std::make_shared<MeshData>(std::move(data));
+        if (owned->clusters.empty())
+            owned->clusters = build_clusters(*owned);
+        positions = owned->positions;
+        normals = owned->normals;
+        uvs = owned->uvs;
+        indices = owned->indices;
+        clusters = owned->clusters;
+        bounds = compute_bounds(positions);
+        storage = std::move(owned);
+    }
+
+    // views into memory owned by storage, e.g. a mapped file
+    Mesh(std::shared_ptr<const void> storage, std::span<const vec3r> positions, std::span<const vec3r> normals,
+         std::span<const vec2r> uvs, std::span<const uint32_t> indices, std::span<const MeshCluster> clusters, const Bounds &bounds)
+        : positions(positions), normals(normals), uvs(uvs), indices(indices), clusters(clusters), bounds(bounds), storage(std::move(storage)) {}
+
+    bool has_normals() const { return !normals.empty(); }
+    bool has_uvs() const { return !uvs.empty(); }
+    int vertex_count() const { return static_cast<int>(positions.size()); }
+    int triangle_count() const { return static_cast<int>(indices.size() / 3); }
+
+    size_t memory_bytes() const
+    {
+        return positions.size_bytes() + normals.size_bytes() + uvs.size_bytes() + indices.size_bytes() + clusters.size_bytes();
+    }
+
+private:
+    std::shared_ptr<const void> storage;
+};
+
+// builds a mesh from .obj style corners, which index positions, uvs and normals separately
+// every distinct (v, vt, vn) triple becomes one vertex; index arrays that are empty mean the attribute is missing
+MeshData build_mesh(const std::vector<vec3r> &positions, const std::vector<vec3r> &normals, const std::vector<vec2r> &uvs,
+                    const std::vector<int> &point_indices, const std::vector<int> &normal_indices, const std::vector<int> &uv_indices)
+{
+    struct Corner
+    {
+        int v, vt, vn;
+        bool operator==(const Corner &other) const { return v == other.v && vt == other.vt && vn == other.vn; }
+    };
+    struct CornerHash
+    {
+        size_t operator()(const Corner &c) const
+        {
+            uint64_t h = static_cast<uint32_t>(c.v);
+            h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(c.vt);
+            h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(c.vn);
+            return static_cast<size_t>(h ^ (h >> 32));
+        }
+    };
+
+    MeshData mesh;
+    bool with_normals = !normal_indices.empty();
+    bool with_uvs = !uv_indices.empty();
+    std::unordered_map<Corner, uint32_t, CornerHash> unique;
+    unique.reserve(point_indices.size());
+    mesh.indices.reserve(point_indices.size());
+
+    for (size_t c = 0; c < point_indices.size(); ++c)
+    {
+        Corner corner{point_indices[c], with_uvs ? uv_indices[c] : 0, with_normals ? normal_indices[c] : 0};
+        auto inserted = unique.emplace(corner, static_cast<uint32_t>(mesh.positions.size()));
+        if (inserted.second)
+        {
+            mesh.positions.push_back(positions[corner.v]);
+            if (with_normals)
+                mesh.normals.push_back(normals[corner.vn]);
+            if (with_uvs)
+                mesh.uvs.push_back(uvs[corner.vt]);
+        }
+        mesh.indices.push_back(inserted.first->second);
+    }
+    return mesh;
+}
+
+// reorders triangles for the post-transform vertex cache with Tipsify (Sander, Nehab, Barczak 2007)
+// linear in the triangle count; cache_size is the FIFO size the order is tuned for
+void optimize_vertex_cache(MeshData &mesh, int cache_size = 16)
+{
+    int vertex_count = mesh.vertex_count();
+    int triangle_count = mesh.triangle_count();
+    if (triangle_count == 0)
+        return;
+
+    // vertex -> triangles adjacency, as offsets into one flat array
+    std::vector<int> live(vertex_count, 0);
+    for (uint32_t index : mesh.indices)
+        ++live[index];
+    std::vector<int> offsets(vertex_count + 1, 0);
+    for (int v = 0; v < vertex_count; ++v)
+        offsets[v + 1] = offsets[v] + live[v];
+    std::vector<int> adjacency(mesh.indices.size());
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int t = 0; t < triangle_count; ++t)
+        for (int k = 0; k < 3; ++k)
+            adjacency[fill[mesh.indices[3 * t + k]]++] = t;
+
+    std::vector<int> cache_time(vertex_count, 0);
+    std::vector<char> emitted(triangle_count, 0);
+    std::vector<int> dead_end;
+    std::vector<uint32_t> output;
+    output.reserve(mesh.indices.size());
+
+    int fanning = 0;
+    int time = cache_size + 1;
+    int cursor = 1;
+
+    while (fanning >= 0)
+    {
+        std::vector<int> candidates;
+        for (int a = offsets[fanning]; a < offsets[fanning + 1]; ++a)
+        {
+            int t = adjacency[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = mesh.indices[3 * t + k];
+                output.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+        }
+
+        // next fanning vertex: the candidate that stays in cache longest after emitting its remaining triangles
+        int best = -1;
+        int best_priority = -1;
+        for (int v : candidates)
+        {
+            if (live[v] <= 0)
+                continue;
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size)
+                priority = time - cache_time[v];
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                best = v;
+            }
+        }
+
+        if (best == -1)
+        {
+            // dead end: back up through recently used vertices, then scan for any vertex with work left
+            while (!dead_end.empty() && best == -1)
+            {
+                int v = dead_end.back();
+                dead_end.pop_back();
+                if (live[v] > 0)
+                    best = v;
+            }
+            while (best == -1 && cursor < vertex_count)
+            {
+                if (live[cursor] > 0)
+                    best = cursor;
+                ++cursor;
+            }
+        }
+        fanning = best;
+    }
+
+    mesh.indices = std::move(output);
+}
+
+// renumbers vertices in order of first use so the vertex stage and raster walk the attribute arrays forwards
+void optimize_vertex_fetch(MeshData &mesh)
+{
+    const uint32_t unused = UINT32_MAX;
+    std::vector<uint32_t> remap(mesh.vertex_count(), unused);
+    uint32_t next = 0;
+    for (uint32_t &index : mesh.indices)
+    {
+        if (remap[index] == unused)
+            remap[index] = next++;
+        index = remap[index];
+    }
+
+    auto reorder = [&](auto &attribute)
+    {
+        if (attribute.empty())
+            return;
+        std::remove_reference_t<decltype(attribute)> sorted(next);
+        for (size_t v = 0; v < remap.size(); ++v)
+            if (remap[v] != unused)
+                sorted[remap[v]] = attribute[v];
+        attribute = std::move(sorted);
+    };
+    reorder(mesh.positions);
+    reorder(mesh.normals);
+    reorder(mesh.uvs);
+}
+
+// a coarser copy of a mesh for drawing it far away, by vertex clustering (Rossignac and Borrel 1993):
+// the bounds are cut into cubes, `cells` along the longest side, and each cube's vertices merge into one
+// at their mean position, with the normal and uv of the vertex nearest it. Triangles left with two corners
+// in one cube disappear, as do repeats of a triangle with the same winding.
+MeshData simplify_mesh(const Mesh &mesh, int cells)
+{
+    vec3r extent = mesh.bounds.max - mesh.bounds.min;
+    real cell_size = std::max({extent.x(), extent.y(), extent.z()}) / std::max(cells, 1);
+    if (!(cell_size > 0))
+        cell_size = 1;
+    auto cell_of = [&](const vec3r &p)
+    {
+        vec3r c = (p - mesh.bounds.min) * (1 / cell_size);
+        auto axis = [&](real v)
+        { return static_cast<uint64_t>(std::clamp(static_cast<int>(v), 0, cells - 1)); };
+        return axis(c.x()) | axis(c.y()) << 21 | axis(c.z()) << 42;
+    };
+
+    // cube of every vertex, and the mean position of every cube
+    std::unordered_map<uint64_t, uint32_t> cube_index;
+    std::vector<uint32_t> cube(mesh.vertex_count());
+    std::vector<vec3r> sum; // then the mean
+    std::vector<int> count;
+    for (int v = 0; v < mesh.vertex_count(); ++v)
+    {
+        auto inserted = cube_index.emplace(cell_of(mesh.positions[v]), static_cast<uint32_t>(sum.size()));
+        if (inserted.second)
+        {
+            sum.push_back(vec3r());
+            count.push_back(0);
+        }
+        cube[v] = inserted.first->second;
+        sum[cube[v]] += mesh.positions[v];
+        ++count[cube[v]];
+    }
+    for (size_t c = 0; c < sum.size(); ++c)
+        sum[c] *= 1 / static_cast<real>(count[c]);
+    std::vector<uint32_t> nearest(sum.size(), 0);
+    std::vector<real> nearest_distance(sum.size(), std::numeric_limits<real>::max());
+    for (int v = 0; v < mesh.vertex_count(); ++v)
+    {
+        vec3r offset = mesh.positions[v] - sum[cube[v]];
+        if (dot(offset, offset) < nearest_distance[cube[v]])
+        {
+            nearest_distance[cube[v]] = dot(offset, offset);
+            nearest[cube[v]] = v;
+        }
+    }
+
+    // cubes become vertices in order of first use, as optimize_vertex_fetch would leave them
+    MeshData simplified;
+    const uint32_t unused = UINT32_MAX;
+    std::vector<uint32_t> remap(sum.size(), unused);
+    std::unordered_map<uint64_t, char> seen;
+    for (int t = 0; t < mesh.triangle_count(); ++t)
+    {
+        uint32_t c[3];
+        for (int k = 0; k < 3; ++k)
+            c[k] = cube[mesh.indices[3 * t + k]];
+        if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0])
+            continue;
+        // the same triangle starts from its smallest cube, so only true repeats match
+        int first = c[0] < c[1] ? (c[0] < c[2] ? 0 : 2) : (c[1] < c[2] ? 1 : 2);
+        uint64_t key = uint64_t(c[first]) | uint64_t(c[(first + 1) % 3]) << 21 | uint64_t(c[(first + 2) % 3]) << 42;
+        if (!seen.emplace(key, 0).second)
+            continue;
+        for (int k = 0; k < 3; ++k)
+        {
+            if (remap[c[k]] == unused)
+            {
+                remap[c[k]] = static_cast<uint32_t>(simplified.positions.size());
+                simplified.positions.push_back(sum[c[k]]);
+                if (mesh.has_normals())
+                    simplified.normals.push_back(mesh.normals[nearest[c[k]]]);
+                if (!mesh.uvs.empty())
+                    simplified.uvs.push_back(mesh.uvs[nearest[c[k]]]);
+            }
+            simplified.indices.push_back(remap[c[k]]);
+        }
+    }
+    return simplified;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+
+// Binary copies of loaded meshes, written next to the source as <file>.mesh and mapped straight into a Mesh on later loads.
+// Layout: MeshCacheHeader, then positions, normals, uvs, indices and clusters, each starting on a MESH_CACHE_ALIGNMENT boundary.
+// A cache is used when it was written for the same load options and precision and its source still has the same size
+// and modification time; if only the time changed (a fresh checkout, a touch) the source's hash decides.
+
+const uint32_t MESH_CACHE_VERSION = 2;
+const size_t MESH_CACHE_ALIGNMENT = 16;
+
+// load options that change the cached data
+const uint32_t MESH_CACHE_TWO_PART_IS_NORMAL = 1;
+const uint32_t MESH_CACHE_OPTIMIZED = 2;
+
+struct MeshCacheHeader
+{
+    char magic[4]; // "RMSH"
+    uint32_t version;
+    uint32_t real_size; // sizeof(real) of the build that wrote it
+    uint32_t flags;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+    uint64_t vertex_count;
+    uint64_t index_count;
+    uint64_t cluster_count;
+    uint32_t has_normals;
+    uint32_t has_uvs;
+    uint64_t positions_offset, normals_offset, uvs_offset, indices_offset, clusters_offset;
+    double bounds_min[3], bounds_max[3], bounds_center[3], bounds_radius;
+};
+
+struct SourceStamp
+{
+    uint64_t size;
+    int64_t mtime;
+};
+
+inline SourceStamp source_stamp(const std::string &path)
+{
+    return SourceStamp{static_cast<uint64_t>(std::filesystem::file_size(path)),
+                       static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count())};
+}
+
+// FNV-1a, 64 bit
+inline uint64_t hash_bytes(std::string_view bytes)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : bytes)
+        hash = (hash ^ c) * 0x100000001b3ull;
+    return hash;
+}
+
+inline std::string mesh_cache_path(const std::string &source)
+{
+    return source + ".mesh";
+}
+
+// RASTERIZER_MESH_CACHE=0 turns the cache off
+inline bool mesh_cache_enabled()
+{
+    const char *setting = std::getenv("RASTERIZER_MESH_CACHE");
+    return !setting || std::string(setting) != "0";
+}
+
+inline size_t align_cache_offset(size_t offset)
+{
+    return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+}
+
+// writes the cache for `source` through a temporary file, so concurrent loads never see half a cache
+// returns false if it couldn't be written; callers carry on with the mesh they have
+bool write_mesh_cache(const std::string &source, const Mesh &mesh, uint32_t flags)
+{
+    MeshCacheHeader header{};
+    std::memcpy(header.magic, "RMSH", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.real_size = sizeof(real);
+    header.flags = flags;
+    header.vertex_count = mesh.positions.size();
+    header.index_count = mesh.indices.size();
+    header.cluster_count = mesh.clusters.size();
+    header.has_normals = mesh.has_normals();
+    header.has_uvs = mesh.has_uvs();
+    header.positions_offset = align_cache_offset(sizeof(MeshCacheHeader));
+    header.normals_offset = align_cache_offset(header.positions_offset + mesh.positions.size_bytes());
+    header.uvs_offset = align_cache_offset(header.normals_offset + mesh.normals.size_bytes());
+    header.indices_offset = align_cache_offset(header.uvs_offset + mesh.uvs.size_bytes());
+    header.clusters_offset = align_cache_offset(header.indices_offset + mesh.indices.size_bytes());
+    for (int k = 0; k < 3; ++k)
+    {
+        header.bounds_min[k] = mesh.bounds.min[k];
+        header.bounds_max[k] = mesh.bounds.max[k];
+        header.bounds_center[k] = mesh.bounds.center[k];
+    }
+    header.bounds_radius = mesh.bounds.radius;
+
+    std::string path = mesh_cache_path(source);
+    std::string temporary = path + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    try
+    {
+        SourceStamp stamp = source_stamp(source);
+        MappedFile bytes(source);
+        header.source_size = stamp.size;
+        header.source_mtime = stamp.mtime;
+        header.source_hash = hash_bytes(bytes.view());
+
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+        auto write_at = [&](uint64_t offset, const void *data, size_t size)
+        {
+            static const char padding[MESH_CACHE_ALIGNMENT] = {};
+            file.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+            file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+        };
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        write_at(header.positions_offset, mesh.positions.data(), mesh.positions.size_bytes());
+        write_at(header.normals_offset, mesh.normals.data(), mesh.normals.size_bytes());
+        write_at(header.uvs_offset, mesh.uvs.data(), mesh.uvs.size_bytes());
+        write_at(header.indices_offset, mesh.indices.data(), mesh.indices.size_bytes());
+        write_at(header.clusters_offset, mesh.clusters.data(), mesh.clusters.size_bytes());
+        file.close();
+        if (!file)
+        {
+            std::filesystem::remove(temporary);
+            return false;
+        }
+        std::filesystem::rename(temporary, path);
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        std::error_code ignored;
+        std::filesystem::remove(temporary, ignored);
+        return false;
+    }
+}
+
+// stores the source's new modification time in a cache whose hash still matched, so later loads don't hash it again
+// only that field changes, in place; a cache that can't be written is still used, it just gets hashed every time
+inline void refresh_mesh_cache_mtime(const std::string &path, int64_t mtime)
+{
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file.is_open())
+        return;
+    file.seekp(offsetof(MeshCacheHeader, source_mtime));
+    file.write(reinterpret_cast<const char *>(&mtime), sizeof(mtime));
+}
+
+// maps the cache for `source` if it is up to date, otherwise returns null
+std::shared_ptr<const Mesh> read_mesh_cache(const std::string &source, uint32_t flags)
+{
+    std::string path = mesh_cache_path(source);
+    std::error_code error;
+    if (!std::filesystem::exists(path, error))
+        return nullptr;
+
+    try
+    {
+        auto file = std::make_shared<MappedFile>(path);
+        if (file->length() < sizeof(MeshCacheHeader))
+            return nullptr;
+        MeshCacheHeader header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (std::memcmp(header.magic, "RMSH", 4) != 0 || header.version != MESH_CACHE_VERSION ||
+            header.real_size != sizeof(real) || header.flags != flags)
+            return nullptr;
+
+        size_t vertices = header.vertex_count;
+        size_t normals = header.has_normals ? vertices : 0;
+        size_t uvs = header.has_uvs ? vertices : 0;
+        size_t indices = header.index_count;
+        size_t clusters = header.cluster_count;
+        if (vertices > file->length() || indices > file->length() || clusters > file->length() ||
+            header.positions_offset % MESH_CACHE_ALIGNMENT || header.normals_offset % MESH_CACHE_ALIGNMENT ||
+            header.uvs_offset % MESH_CACHE_ALIGNMENT || header.indices_offset % MESH_CACHE_ALIGNMENT ||
+            header.clusters_offset % MESH_CACHE_ALIGNMENT ||
+            header.positions_offset + vertices * sizeof(vec3r) > file->length() ||
+            header.normals_offset + normals * sizeof(vec3r) > file->length() ||
+            header.uvs_offset + uvs * sizeof(vec2r) > file->length() ||
+            header.indices_offset + indices * sizeof(uint32_t) > file->length() ||
+            header.clusters_offset + clusters * sizeof(MeshCluster) > file->length() || indices % 3)
+            return nullptr;
+
+        SourceStamp stamp = source_stamp(source);
+        if (stamp.size != header.source_size)
+            return nullptr;
+        bool touched = stamp.mtime != header.source_mtime;
+        if (touched && hash_bytes(MappedFile(source).view()) != header.source_hash)
+            return nullptr;
+
+        const char *base = file->data();
+        std::span<const uint32_t> index_view(reinterpret_cast<const uint32_t *>(base + header.indices_offset), indices);
+        for (uint32_t index : index_view)
+            if (index >= vertices)
+                return nullptr;
+        std::span<const MeshCluster> cluster_view(reinterpret_cast<const MeshCluster *>(base + header.clusters_offset), clusters);
+        size_t next_triangle = 0;
+        for (const MeshCluster &cluster : cluster_view)
+        {
+            if (cluster.first_triangle != next_triangle || cluster.vertex_end > vertices)
+                return nullptr;
+            next_triangle += cluster.triangle_count;
+        }
+        if (next_triangle != indices / 3)
+            return nullptr;
+
+        Bounds bounds;
+        for (int k = 0; k < 3; ++k)
+        {
+            bounds.min[k] = static_cast<real>(header.bounds_min[k]);
+            bounds.max[k] = static_cast<real>(header.bounds_max[k]);
+            bounds.center[k] = static_cast<real>(header.bounds_center[k]);
+        }
+        bounds.radius = static_cast<real>(header.bounds_radius);
+        if (touched)
+            refresh_mesh_cache_mtime(path, stamp.mtime);
+        return std::make_shared<const Mesh>(
+            file,
+            std::span<const vec3r>(reinterpret_cast<const vec3r *>(base + header.positions_offset), vertices),
+            std::span<const vec3r>(reinterpret_cast<const vec3r *>(base + header.normals_offset), normals),
+            std::span<const vec2r>(reinterpret_cast<const vec2r *>(base + header.uvs_offset), uvs),
+            index_view, cluster_view, bounds);
+    }
+    catch (const std::exception &)
+    {
+        return nullptr; // unreadable caches are rebuilt from the source
+    }
+}
@@ -1,162 +1,346 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
-#include <list>
-#include <fstream>
+#include <charconv>
+#include <cstring>
 #include <stdexcept>
 #include "math.hpp"
 #include "util.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+#include "mesh_cache.hpp"
+#include "assets.hpp"
 
-// from https://stackoverflow.com/questions/14265581/parse-split-a-string-in-c-using-string-delimiter-standard-c
-// this function splits a string by a delimiter and returns a vector of strings
-std::vector<std::string> split(std::string s, std::string delimiter)
+// files are split into chunks of about this many bytes, each parsed on its own worker
+const size_t OBJ_CHUNK_SIZE = 1 << 20;
+
+// relative (negative) face indices can't be resolved until the merge knows how many attributes came before the chunk,
+// so they are stored biased into the negative range: stored = (chunk-local position) - OBJ_RELATIVE_BIAS
+const int OBJ_RELATIVE_BIAS = 1 << 30;
+
+// attributes and triangulated corners as they appear in a .obj, before welding into a Mesh
+struct ObjData
 {
-    size_t pos_start = 0, pos_end, delim_len = delimiter.length();
-    std::string token;
-    std::vector<std::string> res;
+    std::vector<vec3r> positions;
+    std::vector<vec3r> normals;
+    std::vector<vec2r> uvs;
+    // three entries per triangle, one per corner; uv and normal indices are empty when some face lacks them
+    std::vector<int> point_indices;
+    std::vector<int> normal_indices;
+    std::vector<int> uv_indices;
+};
 
-    while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos)
-    {
-        token = s.substr(pos_start, pos_end - pos_start);
-        pos_start = pos_end + delim_len;
-        res.push_back(token);
-    }
+// one chunk's output; the corner arrays always have one entry per corner, missing_* records gaps
+struct ObjChunk
+{
+    ObjData data;
+    bool missing_uvs = false;
+    bool missing_normals = false;
+};
 
-    res.push_back(s.substr(pos_start));
-    return res;
+inline const char *obj_skip_space(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    return p;
 }
 
-// a basic .obj parser
-Model load_object(const std::string &obj, const std::string &texture_filename = "_no_texture", vector3 base_color = vector3(255, 255, 255))
+inline bool obj_parse_real(const char *&p, const char *end, real &out)
 {
-    std::vector<vector3> all_points;
-    std::vector<vector3> triangle_points;
-    std::vector<vector2> texture_coords_vt;
-    std::vector<vector3> normals_vn;
-    std::vector<vector3> normals;
-    std::vector<vector2> texture_coords;
-
-    std::ifstream file(obj);
-    if (!file.is_open())
-        throw std::runtime_error("Failed to open file: " + obj);
-
-    std::string line;
-    while (std::getline(file, line))
+    p = obj_skip_space(p, end);
+    if (p < end && *p == '+')
+        ++p;
+    double value;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    out = static_cast<real>(value);
+    p = result.ptr;
+    return true;
+}
+
+// reads one 1-based (or negative, relative) index and stores it as described at OBJ_RELATIVE_BIAS
+inline bool obj_parse_index(const char *&p, const char *end, int local_count, int &out)
+{
+    int value;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc() || value == 0)
+        return false;
+    out = value > 0 ? value - 1 : local_count + value - OBJ_RELATIVE_BIAS;
+    p = result.ptr;
+    return true;
+}
+
+// parses the whole lines in [begin, end)
+// two_part_is_normal: faces written as a/b index a normal rather than a uv (untextured models use this)
+void parse_obj_chunk(const char *begin, const char *end, bool two_part_is_normal, const std::string &name, ObjChunk &chunk)
+{
+    ObjData &out = chunk.data;
+    // corners of the current face, reused for every face
+    std::vector<int> face_v, face_vt, face_vn;
+
+    for (const char *line = begin; line < end;)
     {
-        if (line.empty() || line[0] == '#')
+        const char *line_end = static_cast<const char *>(std::memchr(line, '\n', end - line));
+        if (!line_end)
+            line_end = end;
+        const char *p = obj_skip_space(line, line_end);
+        line = line_end + 1;
+
+        if (p + 1 >= line_end || *p == '#')
             continue;
 
-        if (line.rfind("v ", 0) == 0)
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
         {
-            double x, y, z;
-            if (sscanf(line.c_str(), "v %lf %lf %lf", &x, &y, &z) == 3)
-                all_points.emplace_back(x, y, z);
-            else
-                throw std::runtime_error("Invalid vertex format in file: " + obj);
+            real x, y, z;
+            p += 1;
+            if (!obj_parse_real(p, line_end, x) || !obj_parse_real(p, line_end, y) || !obj_parse_real(p, line_end, z))
+                throw std::runtime_error("Invalid vertex format in file: " + name);
+            out.positions.emplace_back(x, y, z);
         }
-        else if (line.rfind("vt ", 0) == 0)
+        else if (p[0] == 'v' && p[1] == 't')
         {
-            double u, v;
-            if (sscanf(line.c_str(), "vt %lf %lf", &u, &v) == 2)
-                texture_coords_vt.emplace_back(vector2(u, v));
-            else
-                throw std::runtime_error("Invalid texture coordinate format in file: " + obj);
+            real u, v;
+            p += 2;
+            if (!obj_parse_real(p, line_end, u) || !obj_parse_real(p, line_end, v))
+                throw std::runtime_error("Invalid texture coordinate format in file: " + name);
+            out.uvs.emplace_back(u, v);
         }
-        else if (line.rfind("vn ", 0) == 0)
+        else if (p[0] == 'v' && p[1] == 'n')
         {
-            double nx, ny, nz;
-            if (sscanf(line.c_str(), "vn %lf %lf %lf", &nx, &ny, &nz) == 3)
-                normals_vn.emplace_back(vector3(nx, ny, nz));
-            else
-                throw std::runtime_error("Invalid normal format in file: " + obj);
+            real x, y, z;
+            p += 2;
+            if (!obj_parse_real(p, line_end, x) || !obj_parse_real(p, line_end, y) || !obj_parse_real(p, line_end, z))
+                throw std::runtime_error("Invalid normal format in file: " + name);
+            out.normals.emplace_back(x, y, z);
         }
-        else if (line.rfind("f ", 0) == 0)
+        else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
         {
-            std::vector<std::string> tokens = split(line, " ");
-            std::vector<int> face_indices;
-            std::vector<int> face_textures;
-            std::vector<int> face_normals;
-
-            std::string splitter = "/";
-            if (line.find("//") != std::string::npos)
-            {
-                splitter = "//";
-            }
+            face_v.clear();
+            face_vt.clear();
+            face_vn.clear();
+            bool has_vt = true, has_vn = true;
+            int positions = static_cast<int>(out.positions.size());
+            int uvs = static_cast<int>(out.uvs.size());
+            int normals = static_cast<int>(out.normals.size());
 
-            for (size_t i = 1; i < tokens.size(); ++i)
+            p = obj_skip_space(p + 1, line_end);
+            while (p < line_end)
             {
-                std::vector<std::string> parts = split(tokens[i], splitter);
-                if (parts.empty() || parts[0].empty())
-                    throw std::runtime_error("Invalid face format in file: " + obj);
-
-                int input_size = parts.size();
-                int face_index = 0;
-                int texture_index = 0;
-                int normal_index = 0;
-                switch (input_size)
+                // v, v/vt, v//vn or v/vt/vn
+                int v, vt = 0, vn = 0;
+                bool got_vt = false, got_vn = false;
+                if (!obj_parse_index(p, line_end, positions, v))
+                    throw std::runtime_error("Invalid face format in file: " + name);
+                if (p < line_end && *p == '/')
                 {
-                case 1:
-                    face_index = std::stoi(parts[0]) - 1;
-                    face_indices.push_back(face_index);
-                    break;
-                case 2:
-                    face_index = std::stoi(parts[0]) - 1;
-                    texture_index = std::stoi(parts[1]) - 1;
-                    if (texture_filename != "_no_texture")
+                    ++p;
+                    if (p < line_end && *p == '/')
                     {
-                        face_indices.push_back(face_index);
-                        face_textures.push_back(texture_index);
+                        ++p;
+                        if (!obj_parse_index(p, line_end, normals, vn))
+                            throw std::runtime_error("Invalid face format in file: " + name);
+                        got_vn = true;
                     }
                     else
                     {
-                        face_indices.push_back(face_index);
-                        face_normals.push_back(texture_index);
+                        if (!obj_parse_index(p, line_end, two_part_is_normal ? normals : uvs, vt))
+                            throw std::runtime_error("Invalid face format in file: " + name);
+                        got_vt = true;
+                        if (p < line_end && *p == '/')
+                        {
+                            ++p;
+                            if (!obj_parse_index(p, line_end, normals, vn))
+                                throw std::runtime_error("Invalid face format in file: " + name);
+                            got_vn = true;
+                        }
+                        else if (two_part_is_normal)
+                        {
+                            std::swap(vt, vn);
+                            got_vt = false;
+                            got_vn = true;
+                        }
                     }
-                    break;
-                case 3:
-                    face_index = std::stoi(parts[0]) - 1;
-                    texture_index = std::stoi(parts[1]) - 1;
-                    normal_index = std::stoi(parts[2]) - 1;
-                    face_indices.push_back(face_index);
-                    face_textures.push_back(texture_index);
-                    face_normals.push_back(normal_index);
-                    break;
-                default:
-                    throw std::runtime_error("Invalid face format in file: " + obj);
-                    break;
                 }
+                if (p < line_end && *p != ' ' && *p != '\t' && *p != '\r')
+                    throw std::runtime_error("Invalid face format in file: " + name);
+
+                face_v.push_back(v);
+                face_vt.push_back(vt);
+                face_vn.push_back(vn);
+                has_vt = has_vt && got_vt;
+                has_vn = has_vn && got_vn;
+                p = obj_skip_space(p, line_end);
             }
-            // Triangle fan
-            for (size_t i = 1; i + 1 < face_indices.size(); ++i)
-            {
-                triangle_points.push_back(all_points[face_indices[0]]);
-                triangle_points.push_back(all_points[face_indices[i]]);
-                triangle_points.push_back(all_points[face_indices[i + 1]]);
 
-                if (texture_coords_vt.size() > 0)
-                {
-                    texture_coords.push_back(texture_coords_vt[face_textures[0]]);
-                    texture_coords.push_back(texture_coords_vt[face_textures[i]]);
-                    texture_coords.push_back(texture_coords_vt[face_textures[i + 1]]);
-                }
+            chunk.missing_uvs = chunk.missing_uvs || (!has_vt && face_v.size() >= 3);
+            chunk.missing_normals = chunk.missing_normals || (!has_vn && face_v.size() >= 3);
 
-                if (normals_vn.size() > 0)
+            // triangle fan
+            for (size_t i = 1; i + 1 < face_v.size(); ++i)
+            {
+                size_t corners[3] = {0, i, i + 1};
+                for (size_t c : corners)
                 {
-                    normals.push_back(normals_vn[face_normals[0]]);
-                    normals.push_back(normals_vn[face_normals[i]]);
-                    normals.push_back(normals_vn[face_normals[i + 1]]);
+                    out.point_indices.push_back(face_v[c]);
+                    out.uv_indices.push_back(face_vt[c]);
+                    out.normal_indices.push_back(face_vn[c]);
                 }
             }
         }
     }
+}
+
+// concatenates the chunks' attributes and rebases their indices onto the concatenated arrays
+ObjData merge_obj_chunks(std::vector<ObjChunk> &chunks, const std::string &name)
+{
+    size_t chunk_count = chunks.size();
+    std::vector<size_t> position_base(chunk_count + 1, 0), uv_base(chunk_count + 1, 0), normal_base(chunk_count + 1, 0), corner_base(chunk_count + 1, 0);
+    bool missing_uvs = false, missing_normals = false;
+    for (size_t c = 0; c < chunk_count; ++c)
+    {
+        const ObjData &data = chunks[c].data;
+        position_base[c + 1] = position_base[c] + data.positions.size();
+        uv_base[c + 1] = uv_base[c] + data.uvs.size();
+        normal_base[c + 1] = normal_base[c] + data.normals.size();
+        corner_base[c + 1] = corner_base[c] + data.point_indices.size();
+        missing_uvs = missing_uvs || chunks[c].missing_uvs;
+        missing_normals = missing_normals || chunks[c].missing_normals;
+    }
+
+    bool with_uvs = !missing_uvs && uv_base[chunk_count] > 0;
+    bool with_normals = !missing_normals && normal_base[chunk_count] > 0;
+
+    auto rebase = [&](const std::vector<int> &in, int *out, size_t base, size_t count)
+    {
+        for (size_t i = 0; i < in.size(); ++i)
+        {
+            long long index = in[i] < 0 ? static_cast<long long>(base) + in[i] + OBJ_RELATIVE_BIAS : in[i];
+            if (index < 0 || static_cast<size_t>(index) >= count)
+                throw std::runtime_error("Face index out of range in file: " + name);
+            out[i] = static_cast<int>(index);
+        }
+    };
+
+    if (chunk_count == 1)
+    {
+        // the common small-file case: resolve in place, nothing to concatenate
+        ObjData &data = chunks[0].data;
+        rebase(data.point_indices, data.point_indices.data(), 0, data.positions.size());
+        if (with_uvs)
+            rebase(data.uv_indices, data.uv_indices.data(), 0, data.uvs.size());
+        else
+            data.uv_indices.clear();
+        if (with_normals)
+            rebase(data.normal_indices, data.normal_indices.data(), 0, data.normals.size());
+        else
+            data.normal_indices.clear();
+        return std::move(data);
+    }
+
+    ObjData merged;
+    merged.positions.resize(position_base[chunk_count]);
+    merged.uvs.resize(uv_base[chunk_count]);
+    merged.normals.resize(normal_base[chunk_count]);
+    merged.point_indices.resize(corner_base[chunk_count]);
+    if (with_uvs)
+        merged.uv_indices.resize(corner_base[chunk_count]);
+    if (with_normals)
+        merged.normal_indices.resize(corner_base[chunk_count]);
+
+    thread_pool().parallel_for(static_cast<int>(chunk_count), 1, [&](int begin, int end)
+                               {
+                                   for (int c = begin; c < end; ++c)
+                                   {
+                                       const ObjData &data = chunks[c].data;
+                                       std::copy(data.positions.begin(), data.positions.end(), merged.positions.begin() + position_base[c]);
+                                       std::copy(data.uvs.begin(), data.uvs.end(), merged.uvs.begin() + uv_base[c]);
+                                       std::copy(data.normals.begin(), data.normals.end(), merged.normals.begin() + normal_base[c]);
+                                       rebase(data.point_indices, merged.point_indices.data() + corner_base[c], position_base[c], merged.positions.size());
+                                       if (with_uvs)
+                                           rebase(data.uv_indices, merged.uv_indices.data() + corner_base[c], uv_base[c], merged.uvs.size());
+                                       if (with_normals)
+                                           rebase(data.normal_indices, merged.normal_indices.data() + corner_base[c], normal_base[c], merged.normals.size());
+                                   }
+                               });
+    return merged;
+}
+
+// parses a whole .obj held in memory; chunks of about chunk_size bytes (split on line ends) are parsed in parallel
+ObjData parse_obj(std::string_view text, bool two_part_is_normal, const std::string &name, size_t chunk_size = OBJ_CHUNK_SIZE)
+{
+    const char *begin = text.data();
+    const char *end = begin + text.size();
+    size_t chunk_count = std::max<size_t>(1, text.size() / std::max<size_t>(chunk_size, 1));
+
+    std::vector<const char *> bounds(chunk_count + 1, end);
+    bounds[0] = begin;
+    for (size_t c = 1; c < chunk_count; ++c)
+    {
+        const char *split = std::max(bounds[c - 1], begin + c * (text.size() / chunk_count));
+        const char *newline = static_cast<const char *>(std::memchr(split, '\n', end - split));
+        bounds[c] = newline ? newline + 1 : end;
+    }
+
+    std::vector<ObjChunk> chunks(chunk_count);
+    thread_pool().parallel_for(static_cast<int>(chunk_count), 1, [&](int first, int last)
+                               {
+                                   for (int c = first; c < last; ++c)
+                                       parse_obj_chunk(bounds[c], bounds[c + 1], two_part_is_normal, name, chunks[c]);
+                               });
+    return merge_obj_chunks(chunks, name);
+}
+
+// parses an .obj and welds its corners into an indexed mesh, optionally reordered for the vertex cache
+MeshData load_mesh_data(const std::string &obj, bool two_part_is_normal, bool optimize)
+{
+    ObjData data;
+    {
+        MappedFile file(obj);
+        data = parse_obj(file.view(), two_part_is_normal, obj);
+    }
+
+    MeshData welded = build_mesh(data.positions, data.normals, data.uvs, data.point_indices, data.normal_indices, data.uv_indices);
+    if (optimize)
+    {
+        optimize_vertex_cache(welded);
+        optimize_vertex_fetch(welded);
+    }
+    return welded;
+}
 
-    file.close();
+// loads the mesh of an .obj, through its binary cache when that is up to date (see mesh_cache.hpp)
+// a missing or stale cache is rewritten after parsing
+std::shared_ptr<const Mesh> load_mesh(const std::string &obj, bool two_part_is_normal, bool optimize = true)
+{
+    uint32_t flags = (two_part_is_normal ? MESH_CACHE_TWO_PART_IS_NORMAL : 0) | (optimize ? MESH_CACHE_OPTIMIZED : 0);
+    bool use_cache = mesh_cache_enabled();
+    if (use_cache)
+    {
+        if (auto cached = read_mesh_cache(obj, flags))
+            return cached;
+    }
+
+    auto mesh = std::make_shared<const Mesh>(load_mesh_data(obj, two_part_is_normal, optimize));
+    if (use_cache)
+        write_mesh_cache(obj, *mesh, flags);
+    return mesh;
+}
+
+// a model instance over shared assets: the mesh and texture are loaded once per path through assets()
+Model load_object(const std::string &obj, const std::string &texture_filename = "_no_texture", vector3 base_color = vector3(255, 255, 255), bool optimize = true)
+{
+    bool two_part_is_normal = texture_filename == "_no_texture";
+    std::string key = obj + (two_part_is_normal ? "|normals" : "|uvs") + (optimize ? "|optimized" : "");
+    auto mesh = assets().mesh(key, [&]()
+                              { return load_mesh(obj, two_part_is_normal, optimize); });
+    std::shared_ptr<const Texture> texture;
+    if (texture_filename != "_no_texture" && mesh->has_uvs())
+        texture = assets().texture(texture_filename);
 
     Transform identity_transform;
-    Model model(triangle_points, normals, texture_coords, identity_transform, Shader(texture_filename));
-    model.shader.has_texture = texture_coords.empty() ? false : true;
-    model.shader.texture.base_color = base_color;
-    return model;
+    return Model(mesh, identity_transform, Shader(texture, base_color));
 }
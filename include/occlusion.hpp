@@ -0,0 +1,223 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include "vec.hpp"
+#include "mesh.hpp"
+#include "raster_kernel.hpp"
+
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 128;
+const int OCCLUSION_BLOCK = 8; // pixels per side of the blocks whose farthest depth is kept for quick rejects
+
+// occluder depths are pushed back by this much, so rounding can't put them in front of the real surface
+const real OCCLUSION_DEPTH_MARGIN = real(1e-5);
+
+// RASTERIZER_OCCLUSION=0 ignores the occluders, for comparing against frustum culling alone
+inline bool occlusion_enabled()
+{
+    const char *setting = std::getenv("RASTERIZER_OCCLUSION");
+    return !setting || std::string(setting) != "0";
+}
+
+// ==================== OcclusionBuffer Class ====================
+// A small depth buffer holding only the chosen occluders, used to drop whatever they hide before the vertex stage.
+// It is conservative: an occluder only writes the pixels it covers completely, with the farthest depth it has inside
+// the pixel, so anything this buffer hides is hidden in the full resolution image too.
+class OcclusionBuffer
+{
+public:
+    int width, height;
+    real scale_x, scale_y; // screen pixels to buffer pixels
+    std::vector<real> depth;
+    std::vector<real> block_farthest;
+    bool enabled = occlusion_enabled();
+
+    OcclusionBuffer(int screen_width = 0, int screen_height = 0, int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT)
+        : width(width), height(height)
+    {
+        scale_x = screen_width ? real(width) / screen_width : 1;
+        scale_y = screen_height ? real(height) / screen_height : 1;
+        depth.resize(width * height);
+        block_farthest.resize(blocks_x() * blocks_y());
+        clear(0);
+    }
+
+    int blocks_x() const { return (width + OCCLUSION_BLOCK - 1) / OCCLUSION_BLOCK; }
+    int blocks_y() const { return (height + OCCLUSION_BLOCK - 1) / OCCLUSION_BLOCK; }
+
+    // nothing drawn yet; occluder triangles with a corner nearer than `near_plane` are left out
+    void clear(real near_plane)
+    {
+        near = near_plane;
+        std::fill(depth.begin(), depth.end(), std::numeric_limits<real>::max());
+        drawn = false;
+    }
+
+    bool empty() const { return !drawn; }
+
+    // draws an occluder; `mvp` maps its model space to the screen like a Draw's
+    // returns the number of front facing triangles that were drawn
+    int draw(const Mesh &mesh, const mat4r &mvp)
+    {
+        projected.resize(mesh.vertex_count());
+        for (size_t v = 0; v < projected.size(); ++v)
+        {
+            const vec3r &p = mesh.positions[v];
+            vec4r clip = mvp * vec4r(p[0], p[1], p[2], real(1));
+            real inverse_w = 1 / clip.w();
+            projected[v] = vec4r(clip.x() * inverse_w * scale_x, clip.y() * inverse_w * scale_y, clip.z(), inverse_w);
+        }
+
+        int count = 0;
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            count += draw_triangle(projected[mesh.indices[i]], projected[mesh.indices[i + 1]], projected[mesh.indices[i + 2]]);
+        drawn |= count > 0;
+        return count;
+    }
+
+    // call once the occluders are in, before any hides()
+    void finish()
+    {
+        for (int by = 0; by < blocks_y(); ++by)
+        {
+            for (int bx = 0; bx < blocks_x(); ++bx)
+            {
+                real farthest = std::numeric_limits<real>::lowest();
+                for (int y = by * OCCLUSION_BLOCK; y < std::min((by + 1) * OCCLUSION_BLOCK, height); ++y)
+                    for (int x = bx * OCCLUSION_BLOCK; x < std::min((bx + 1) * OCCLUSION_BLOCK, width); ++x)
+                        farthest = std::max(farthest, depth[y * width + x]);
+                block_farthest[by * blocks_x() + bx] = farthest;
+            }
+        }
+    }
+
+    // whether the box [min, max], taken to the screen by `to_screen`, is entirely behind the occluders
+    bool hides(const vec3r &min, const vec3r &max, const mat4d &to_screen) const
+    {
+        real nearest = std::numeric_limits<real>::max();
+        real low_x = nearest, low_y = nearest, high_x = -nearest, high_y = -nearest;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            vec4d p = to_screen * vec4d(corner & 1 ? max.x() : min.x(), corner & 2 ? max.y() : min.y(), corner & 4 ? max.z() : min.z(), 1.0);
+            if (p.w() < near)
+                return false; // reaches in front of the camera, can't tell
+            real x = static_cast<real>(p.x() / p.w()) * scale_x;
+            real y = static_cast<real>(p.y() / p.w()) * scale_y;
+            low_x = std::min(low_x, x);
+            high_x = std::max(high_x, x);
+            low_y = std::min(low_y, y);
+            high_y = std::max(high_y, y);
+            nearest = std::min(nearest, static_cast<real>(p.w()));
+        }
+
+        // every buffer pixel the screen rectangle touches
+        int x0 = static_cast<int>(std::max<real>(std::floor(low_x), 0));
+        int x1 = static_cast<int>(std::min<real>(std::ceil(high_x), width));
+        int y0 = static_cast<int>(std::max<real>(std::floor(low_y), 0));
+        int y1 = static_cast<int>(std::min<real>(std::ceil(high_y), height));
+        if (x0 >= x1 || y0 >= y1)
+            return false;
+
+        for (int by = y0 / OCCLUSION_BLOCK; by <= (y1 - 1) / OCCLUSION_BLOCK; ++by)
+        {
+            for (int bx = x0 / OCCLUSION_BLOCK; bx <= (x1 - 1) / OCCLUSION_BLOCK; ++bx)
+            {
+                if (block_farthest[by * blocks_x() + bx] < nearest)
+                    continue;
+                for (int y = std::max(y0, by * OCCLUSION_BLOCK); y < std::min(y1, (by + 1) * OCCLUSION_BLOCK); ++y)
+                    for (int x = std::max(x0, bx * OCCLUSION_BLOCK); x < std::min(x1, (bx + 1) * OCCLUSION_BLOCK); ++x)
+                        if (depth[y * width + x] >= nearest)
+                            return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    real near = 0;
+    bool drawn = false;
+    std::vector<vec4r> projected;
+
+    // corners are (buffer x, buffer y, view depth, 1 / view depth)
+    bool draw_triangle(const vec4r &a, const vec4r &b, const vec4r &c)
+    {
+        if (a.z() < near || b.z() < near || c.z() < near)
+            return false;
+
+        // a triangle less than a pixel across can't cover a whole one
+        real min_x = std::min({a.x(), b.x(), c.x()}), max_x = std::max({a.x(), b.x(), c.x()});
+        real min_y = std::min({a.y(), b.y(), c.y()}), max_y = std::max({a.y(), b.y(), c.y()});
+        if (max_x - min_x < 1 || max_y - min_y < 1)
+            return false;
+
+        int start_x = static_cast<int>(std::clamp<real>(std::floor(min_x), 0, width));
+        int end_x = static_cast<int>(std::clamp<real>(std::ceil(max_x), 0, width));
+        int start_y = static_cast<int>(std::clamp<real>(std::floor(min_y), 0, height));
+        int end_y = static_cast<int>(std::clamp<real>(std::ceil(max_y), 0, height));
+        if (start_x >= end_x || start_y >= end_y)
+            return false;
+
+        // the same edge functions as rasterize_triangle, at pixel centres
+        const vec4r *corners[3] = {&a, &b, &c};
+        real step_x[3], step_y[3], origin[3];
+        real px = start_x + real(0.5);
+        real py = start_y + real(0.5);
+        for (int k = 0; k < 3; ++k)
+        {
+            const vec4r &from = *corners[(k + 1) % 3];
+            const vec4r &to = *corners[(k + 2) % 3];
+            step_x[k] = to.y() - from.y();
+            step_y[k] = from.x() - to.x();
+            origin[k] = step_x[k] * (px - from.x()) + step_y[k] * (py - from.y());
+        }
+        real total_area = origin[0] + origin[1] + origin[2];
+        if (total_area <= 0)
+            return false; // back facing or degenerate; a closed occluder's front faces cover the same pixels
+        real inverse_area = 1 / total_area;
+
+        // 1 / depth is affine on the screen, so its lowest value over a pixel is at a corner:
+        // half a pixel's step in x and y below its value at the centre
+        real inv_step_x = (step_x[0] * a.w() + step_x[1] * b.w() + step_x[2] * c.w()) * inverse_area;
+        real inv_step_y = (step_y[0] * a.w() + step_y[1] * b.w() + step_y[2] * c.w()) * inverse_area;
+        real inv_origin = (origin[0] * a.w() + origin[1] * b.w() + origin[2] * c.w()) * inverse_area;
+        real inv_slack = (std::abs(inv_step_x) + std::abs(inv_step_y)) * real(0.5);
+
+        // edges pulled in by half a pixel along their gradient: a centre inside all of them has its whole pixel inside
+        EdgeRow row;
+        real shrunk[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            shrunk[k] = origin[k] - (std::abs(step_x[k]) + std::abs(step_y[k])) * real(0.5001);
+            row.step[k] = static_cast<float>(step_x[k]);
+            row.inclusive[k] = true;
+        }
+
+        SpanKernel find_span = span_kernel().kernel;
+        for (int y = start_y; y < end_y; ++y)
+        {
+            for (int k = 0; k < 3; ++k)
+                row.e[k] = static_cast<float>(shrunk[k]);
+            int first = 0;
+            int run = find_span(row, end_x - start_x, first);
+
+            real *out = &depth[y * width + start_x];
+            for (int x = first; x < first + run; ++x)
+            {
+                real lowest = inv_origin + inv_step_x * x - inv_slack;
+                if (lowest <= 0)
+                    continue;
+                out[x] = std::min(out[x], (1 / lowest) * (1 + OCCLUSION_DEPTH_MARGIN));
+            }
+
+            for (int k = 0; k < 3; ++k)
+                shrunk[k] += step_y[k];
+            inv_origin += inv_step_y;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RASTERIZER_X86
+#endif
+
+// one row of a triangle's three edge functions, evaluated at the centre of the row's first pixel
+// stepping one pixel to the right adds `step` to every edge
+struct EdgeRow
+{
+    float e[3];
+    float step[3];
+    bool inclusive[3]; // whether samples exactly on the edge belong to the triangle (top-left rule)
+};
+
+// finds the covered pixels among the first `count` pixels of a row
+// a triangle is convex, so they always form one run: returns its length and writes its offset to `first`
+using SpanKernel = int (*)(const EdgeRow &row, int count, int &first);
+
+struct SpanKernelInfo
+{
+    const char *name;
+    SpanKernel kernel;
+};
+
+inline bool edge_inside(float e, bool inclusive)
+{
+    return e > 0 || (e == 0 && inclusive);
+}
+
+int find_span_scalar(const EdgeRow &row, int count, int &first)
+{
+    float e0 = row.e[0], e1 = row.e[1], e2 = row.e[2];
+    int x = 0;
+    for (; x < count; ++x, e0 += row.step[0], e1 += row.step[1], e2 += row.step[2])
+    {
+        if (edge_inside(e0, row.inclusive[0]) && edge_inside(e1, row.inclusive[1]) && edge_inside(e2, row.inclusive[2]))
+            break;
+    }
+    first = x;
+    for (; x < count; ++x, e0 += row.step[0], e1 += row.step[1], e2 += row.step[2])
+    {
+        if (!(edge_inside(e0, row.inclusive[0]) && edge_inside(e1, row.inclusive[1]) && edge_inside(e2, row.inclusive[2])))
+            break;
+    }
+    return x - first;
+}
+
+#ifdef RASTERIZER_X86
+
+// turns the coverage masks of consecutive pixel groups into a run, shared by the SIMD kernels
+// returns true once the end of the run has been found
+inline bool accumulate_span(unsigned mask, unsigned full, int x, int lanes, int &first, int &end)
+{
+    if (first < 0)
+    {
+        if (mask == 0)
+            return false;
+        int start = __builtin_ctz(mask);
+        first = x + start;
+        mask >>= start;
+        unsigned gap = ~mask & (full >> start);
+        if (gap)
+        {
+            end = first + __builtin_ctz(gap);
+            return true;
+        }
+        end = x + lanes;
+        return false;
+    }
+    if (mask == full)
+    {
+        end = x + lanes;
+        return false;
+    }
+    end = x + __builtin_ctz(~mask);
+    return true;
+}
+
+int find_span_sse2(const EdgeRow &row, int count, int &first)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    __m128 e[3], step[3], inclusive[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        e[k] = _mm_add_ps(_mm_set1_ps(row.e[k]), _mm_mul_ps(lane, _mm_set1_ps(row.step[k])));
+        step[k] = _mm_set1_ps(row.step[k] * 4);
+        inclusive[k] = row.inclusive[k] ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+    }
+
+    first = -1;
+    int end = 0;
+    for (int x = 0; x < count; x += 4)
+    {
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int k = 0; k < 3; ++k)
+        {
+            __m128 edge = _mm_or_ps(_mm_cmpgt_ps(e[k], zero), _mm_and_ps(_mm_cmpeq_ps(e[k], zero), inclusive[k]));
+            inside = _mm_and_ps(inside, edge);
+            e[k] = _mm_add_ps(e[k], step[k]);
+        }
+        int lanes = count - x < 4 ? count - x : 4;
+        unsigned full = (1u << lanes) - 1;
+        unsigned mask = static_cast<unsigned>(_mm_movemask_ps(inside)) & full;
+        if (accumulate_span(mask, full, x, lanes, first, end))
+            break;
+    }
+    if (first < 0)
+        return 0;
+    return end - first;
+}
+
+__attribute__((target("avx2,fma"))) int find_span_avx2(const EdgeRow &row, int count, int &first)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 e[3], step[3], inclusive[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        e[k] = _mm256_fmadd_ps(lane, _mm256_set1_ps(row.step[k]), _mm256_set1_ps(row.e[k]));
+        step[k] = _mm256_set1_ps(row.step[k] * 8);
+        inclusive[k] = row.inclusive[k] ? _mm256_castsi256_ps(_mm256_set1_epi32(-1)) : zero;
+    }
+
+    first = -1;
+    int end = 0;
+    for (int x = 0; x < count; x += 8)
+    {
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int k = 0; k < 3; ++k)
+        {
+            __m256 edge = _mm256_or_ps(_mm256_cmp_ps(e[k], zero, _CMP_GT_OQ),
+                                       _mm256_and_ps(_mm256_cmp_ps(e[k], zero, _CMP_EQ_OQ), inclusive[k]));
+            inside = _mm256_and_ps(inside, edge);
+            e[k] = _mm256_add_ps(e[k], step[k]);
+        }
+        int lanes = count - x < 8 ? count - x : 8;
+        unsigned full = (1u << lanes) - 1;
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(inside)) & full;
+        if (accumulate_span(mask, full, x, lanes, first, end))
+            break;
+    }
+    if (first < 0)
+        return 0;
+    return end - first;
+}
+
+#endif
+
+// the widest instruction set the SIMD code paths may use, in order
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// RASTERIZER_SIMD=scalar|sse2|avx2 caps it, for comparing the code paths; anything else means scalar
+// unset, every path picks the widest the CPU supports
+inline SimdLevel simd_setting()
+{
+    const char *setting = std::getenv("RASTERIZER_SIMD");
+    std::string forced = setting ? setting : "";
+    if (forced.empty() || forced == "avx2")
+        return SimdLevel::AVX2;
+    return forced == "sse2" ? SimdLevel::SSE2 : SimdLevel::Scalar;
+}
+
+// picks the widest kernel the CPU supports and simd_setting() allows
+SpanKernelInfo select_span_kernel()
+{
+#ifdef RASTERIZER_X86
+    SimdLevel allowed = simd_setting();
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (has_avx2 && allowed >= SimdLevel::AVX2)
+        return {"avx2", find_span_avx2};
+    if (allowed >= SimdLevel::SSE2)
+        return {"sse2", find_span_sse2};
+#endif
+    return {"scalar", find_span_scalar};
+}
+
+const SpanKernelInfo &span_kernel()
+{
+    static const SpanKernelInfo info = select_span_kernel();
+    return info;
+}
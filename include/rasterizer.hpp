@@ -7,347 +7,929 @@
 #include <fstream>
 #include <stdexcept>
 #include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <csignal>
 #include "math.hpp"
 #include "object_loader.hpp"
 #include "util.hpp"
 #include "image_creator.hpp"
+#include "image_writer.hpp"
+#include "tile_binner.hpp"
+#include "thread_pool.hpp"
+#include "raster_kernel.hpp"
+#include "vertex_stage.hpp"
+#include "scene_bvh.hpp"
+#include "hi_z.hpp"
+#include "clipper.hpp"
+#include "visibility_buffer.hpp"
+#include "render_target.hpp"
+#include "frame_stream.hpp"
 
 const int WIDTH = 720;
 const int HEIGHT = 480;
 const double cam_speed = 0.5;
 const double mouse_sensitivity = 0.001;
-const int NUM_THREADS = std::thread::hardware_concurrency();
 
-vector3 world_to_screen(const vector3 &point, Transform transform, Camera cam, int width, int height)
+// an object the BVH found in view, with its distance from the camera
+struct VisibleObject
 {
-    vector3 vertex_world = transform.to_world_point(point);
-    vector3 vertex_view = cam.transform.to_local_point(vertex_world);
-
-    double screen_height = tan(cam.fov / 2) * 2;
-    double pixels_per_unit = height / screen_height / vertex_view.getZ();
-    vector2 pixel_offset = vector2(
-        vertex_view.getX() * pixels_per_unit + width / 2.0,
-        vertex_view.getY() * pixels_per_unit + height / 2.0);
-
-    return vector3(pixel_offset.getX(), pixel_offset.getY(), vertex_view.getZ());
-}
-
-void render_chunk(Model &model, Image &image, Camera cam, int start, int end)
+    real distance;
+    int object;
+    Visibility visibility;
+};
+
+// what a draw's pixels go through, fixed for the draw
+// the raster loop is compiled once per combination, so none of it is decided per pixel
+struct PipelineState
+{
+    bool textured = false;
+    bool lit = false; // the mesh has normals to light
+    TextureFilter filter = TextureFilter::Nearest;
+    DepthFormat depth = DepthFormat::Float32;
+    bool deferred = false; // only depth and visibility ids are written, shading comes later
+
+    PipelineState() {}
+    PipelineState(const Draw &draw, DepthFormat depth, bool deferred)
+        : textured(draw.shader->has_texture), lit(draw.mesh->has_normals()), filter(draw.shader->filter), depth(depth), deferred(deferred) {}
+};
+
+struct CornerAttributes;
+
+// a raster loop and a deferred shading function compiled for one pipeline state, see PipelineRegistry
+using RasterizeFunction = void (*)(const ScreenTriangle &, const Draw &, const ScreenVertices &, const CornerWeights *, RenderTarget &,
+                                   HiZBuffer &, VisibilityBuffer *, uint32_t, RasterStats &, int, int, int, int);
+using ShadeFunction = vec3r (*)(const CornerAttributes &, const Shader &, real, real, real);
+
+// ==================== FrameContext Class ====================
+// Per-frame working memory of render_scene, kept between frames so nothing is reallocated
+class FrameContext
+{
+public:
+    TileBins bins;
+    std::vector<SceneObject> objects;
+    std::vector<int> occluder_objects;
+    SceneBvh bvh; // over `objects`, refitted every frame
+    OcclusionBuffer occlusion;
+    std::vector<VisibleObject> visible;
+    std::vector<Draw> draws;
+    std::vector<RasterizeFunction> draw_rasterizers; // per draw, for its pipeline state
+    std::vector<ShadeFunction> draw_shaders;         // per draw, for the deferred shading pass
+    ScreenVertices vertices;
+    std::vector<VertexJob> vertex_jobs;
+    std::vector<int> vertex_order; // the draws as the vertex jobs group them
+    TriangleClipper clipper; // set up for the camera every frame
+    HiZBuffer hiz;
+    VisibilityBuffer visibility; // only used for deferred shading
+    std::vector<SetupStats> setup_stats; // one per binning worker
+    std::vector<RasterStats> tile_stats;
+    FrameStats stats;
+
+    FrameContext(int width = 0, int height = 0, int workers = 1)
+        : bins(width, height, workers), occlusion(width, height), hiz(width, height),
+          visibility(width, height, bins.worker_count()), setup_stats(bins.worker_count()), tile_stats(bins.tile_count()) {}
+};
+
+// triangles with at most this many pixel centres in their bounds have them tested in setup
+const int SETUP_SAMPLE_TEST = 4;
+
+// triangle setup, done once per triangle before binning: the signed area rejects degenerate triangles and the faces
+// the draw culls, the clamped pixel bounds reject triangles off the screen, and a triangle with only a few pixel centres
+// in its bounds has them tested directly, so slivers and sub-pixel triangles that cover none are never binned
+// `min_x` .. `max_y` are the triangle's unclamped screen bounds
+bool setup_triangle(ScreenTriangle &tri, CullMode cull, real min_x, real max_x, real min_y, real max_y, int width, int height,
+                    SetupStats &stats)
 {
-    for (int i = start; i < end; i += 3)
+    const vec4r &a = tri.a, &b = tri.b, &c = tri.c;
+    // the sum of rasterize_triangle's edge functions: positive for front faces
+    real area = (c.y() - b.y()) * (a.x() - b.x()) + (b.x() - c.x()) * (a.y() - b.y());
+    if (area == 0)
     {
+        ++stats.degenerate;
+        return false;
+    }
+    if ((cull == CullMode::Back && area < 0) || (cull == CullMode::Front && area > 0))
+    {
+        ++stats.culled;
+        return false;
+    }
 
-        vector3 a = world_to_screen(model.points[i], model.transform, cam, image.width, image.height);
-        vector3 b = world_to_screen(model.points[i + 1], model.transform, cam, image.width, image.height);
-        vector3 c = world_to_screen(model.points[i + 2], model.transform, cam, image.width, image.height);
-        if (a.getZ() < 0 || b.getZ() < 0 || c.getZ() < 0)
+    // pixels are sampled at their centres
+    tri.start_x = static_cast<int>(std::clamp<real>(std::ceil(min_x - real(0.5)), 0, width));
+    tri.end_x = static_cast<int>(std::clamp<real>(std::floor(max_x - real(0.5)) + 1, 0, width));
+    tri.start_y = static_cast<int>(std::clamp<real>(std::ceil(min_y - real(0.5)), 0, height));
+    tri.end_y = static_cast<int>(std::clamp<real>(std::floor(max_y - real(0.5)) + 1, 0, height));
+    if (tri.start_x >= tri.end_x || tri.start_y >= tri.end_y)
+    {
+        ++stats.missed;
+        return false;
+    }
+    if ((tri.end_x - tri.start_x) * (tri.end_y - tri.start_y) > SETUP_SAMPLE_TEST)
+        return true;
+
+    // edges on or next to the boundary count as covering, the rasterizer's fill rule settles them
+    real sign = area > 0 ? 1 : -1;
+    real tolerance = -std::abs(area) * real(1e-5);
+    const vec4r *corners[3] = {&a, &b, &c};
+    for (int y = tri.start_y; y < tri.end_y; ++y)
+    {
+        for (int x = tri.start_x; x < tri.end_x; ++x)
         {
-            continue; // skip triangles that are behind the camera (crude fix)
+            real px = x + real(0.5), py = y + real(0.5);
+            bool covered = true;
+            for (int k = 0; k < 3 && covered; ++k)
+            {
+                const vec4r &from = *corners[(k + 1) % 3];
+                const vec4r &to = *corners[(k + 2) % 3];
+                covered = sign * ((to.y() - from.y()) * (px - from.x()) + (from.x() - to.x()) * (py - from.y())) >= tolerance;
+            }
+            if (covered)
+                return true;
         }
+    }
+    ++stats.missed;
+    return false;
+}
 
-        double min_x = std::min({a.getX(), b.getX(), c.getX()});
-        double max_x = std::max({a.getX(), b.getX(), c.getX()});
+// assembles one triangle from the vertex stage's output, sets it up and bins it
+// triangles reaching behind the near plane or past the guard band are clipped, and every piece on screen is binned
+void bin_triangle(FrameContext &frame, int worker, int draw_index, int i)
+{
+    const Draw &draw = frame.draws[draw_index];
+    const TriangleClipper &clipper = frame.clipper;
+    TileBins &bins = frame.bins;
+    SetupStats &stats = frame.setup_stats[worker];
+    std::span<const uint32_t> indices = draw.mesh->indices;
+    const vec4r &a = frame.vertices.positions[draw.slot(indices[i])];
+    const vec4r &b = frame.vertices.positions[draw.slot(indices[i + 1])];
+    const vec4r &c = frame.vertices.positions[draw.slot(indices[i + 2])];
+
+    ScreenTriangle tri;
+    tri.draw_index = draw_index;
+    tri.first_corner = i;
+    tri.clipped = -1;
+
+    real min_x = std::min({a.x(), b.x(), c.x()});
+    real max_x = std::max({a.x(), b.x(), c.x()});
+    real min_y = std::min({a.y(), b.y(), c.y()});
+    real max_y = std::max({a.y(), b.y(), c.y()});
+    if (clipper.inside(a, b, c, min_x, max_x, min_y, max_y))
+    {
+        tri.a = a;
+        tri.b = b;
+        tri.c = c;
+        if (setup_triangle(tri, draw.cull, min_x, max_x, min_y, max_y, bins.width, bins.height, stats))
+            bins.add(worker, tri);
+        return;
+    }
 
-        double min_y = std::min({a.getY(), b.getY(), c.getY()});
-        double max_y = std::max({a.getY(), b.getY(), c.getY()});
+    if (clipper.outside(a, b, c, min_x, max_x, min_y, max_y))
+        return;
+    if (!clipper.enabled)
+    {
+        ++stats.dropped;
+        return;
+    }
 
-        int start_x = clamp(static_cast<int>(min_x), 0, static_cast<int>(image.width - 1));
-        int end_x = clamp(static_cast<int>(ceil(max_x)), 0, static_cast<int>(image.width - 1));
+    // the polygon that's left is drawn as a fan, which keeps the triangle's winding
+    ClipPolygon polygon;
+    clipper.clip(a, b, c, polygon);
+    for (int k = 1; k + 1 < polygon.count; ++k)
+    {
+        const ClipVertex &first = polygon.vertices[0], &second = polygon.vertices[k], &third = polygon.vertices[k + 1];
+        tri.a = TriangleClipper::project(first.position);
+        tri.b = TriangleClipper::project(second.position);
+        tri.c = TriangleClipper::project(third.position);
+        if (setup_triangle(tri, draw.cull, std::min({tri.a.x(), tri.b.x(), tri.c.x()}), std::max({tri.a.x(), tri.b.x(), tri.c.x()}),
+                           std::min({tri.a.y(), tri.b.y(), tri.c.y()}), std::max({tri.a.y(), tri.b.y(), tri.c.y()}), bins.width, bins.height, stats))
+            bins.add_clipped(worker, tri, CornerWeights{{first.weights, second.weights, third.weights}});
+    }
+}
 
-        int start_y = clamp(static_cast<int>(min_y), 0, static_cast<int>(image.height - 1));
-        int end_y = clamp(static_cast<int>(ceil(max_y)), 0, static_cast<int>(image.height - 1));
+// a triangle's corner attributes: texture coordinates and world space normals
+// pieces of clipped triangles blend theirs from the corners of the mesh triangle they were cut from
+struct CornerAttributes
+{
+    vec2r uv[3];
+    vec3r normals[3];
+    // how the sum of the weights and the texture coordinates times the weights change one pixel to the right and up
+    real sum_dx = 0, sum_dy = 0;
+    vec2r weighted_uv_dx, weighted_uv_dy;
 
-        for (int y = start_y; y < end_y; ++y)
+    void load(const ScreenTriangle &tri, const Draw &draw, const ScreenVertices &vertices, const CornerWeights *clip)
+    {
+        const Mesh &mesh = *draw.mesh;
+        bool has_texture = draw.shader->has_texture;
+        bool has_normals = mesh.has_normals();
+        for (int k = 0; k < 3; ++k)
+        {
+            uint32_t vertex = mesh.indices[tri.first_corner + k];
+            if (has_texture)
+                uv[k] = mesh.uvs[vertex];
+            if (has_normals)
+                normals[k] = vertices.normals[draw.slot(vertex)];
+        }
+        if (clip)
         {
-            for (int x = start_x; x < end_x; ++x)
+            vec2r source_uv[3] = {uv[0], uv[1], uv[2]};
+            vec3r source_normals[3] = {normals[0], normals[1], normals[2]};
+            for (int k = 0; k < 3; ++k)
             {
-                vector2 point(x, y);
-                vector3 weights(0, 0, 0);
+                const vec3r &weight = clip->corner[k];
+                uv[k] = source_uv[0] * weight.x() + source_uv[1] * weight.y() + source_uv[2] * weight.z();
+                normals[k] = source_normals[0] * weight.x() + source_normals[1] * weight.y() + source_normals[2] * weight.z();
+            }
+        }
+    }
 
-                if (point.insideTriangle(vector2(a.getX(), a.getY()), vector2(b.getX(), b.getY()), vector2(c.getX(), c.getY()), weights))
-                {
-                    vector3 depths(a.getZ(), b.getZ(), c.getZ());
-                    vector3 depths_inv(1 / a.getZ(), 1 / b.getZ(), 1 / c.getZ());
-                    double depth = 1 / weights.dot(depths_inv);
+    // `dx` and `dy`: how the weights shade takes change one pixel to the right and up, constant over the triangle
+    void gradients(const real dx[3], const real dy[3])
+    {
+        sum_dx = dx[0] + dx[1] + dx[2];
+        sum_dy = dy[0] + dy[1] + dy[2];
+        weighted_uv_dx = uv[0] * dx[0] + uv[1] * dx[1] + uv[2] * dx[2];
+        weighted_uv_dy = uv[0] * dy[0] + uv[1] * dy[1] + uv[2] * dy[2];
+    }
 
-                    if (depth > image.depth[get_index(x, y, image.width)])
-                    {
-                        continue; // skip if the depth is not closer
-                    }
+    // the colour at a pixel with corner weights w0, w1 and w2 already divided by the corners' view depths
+    template <bool Textured, bool Lit, TextureFilter Filter>
+    vec3r shade(const Shader &shader, real w0, real w1, real w2) const
+    {
+        real inverse_sum = 1 / (w0 + w1 + w2);
 
-                    double w0 = weights.getX() * depths_inv.getX();
-                    double w1 = weights.getY() * depths_inv.getY();
-                    double w2 = weights.getZ() * depths_inv.getZ();
-                    double w_sum = w0 + w1 + w2;
+        // interpolate texture coordinates, and their screen space derivatives for the mip level:
+        // uv is a quotient of two functions affine on the screen, so d(uv) = (d(weighted uv) - uv * d(sum)) / sum
+        vec2r texture_coord(0, 0), uv_dx(0, 0), uv_dy(0, 0);
+        if constexpr (Textured)
+        {
+            texture_coord = (uv[0] * w0 +
+                             uv[1] * w1 +
+                             uv[2] * w2) *
+                            inverse_sum;
+            uv_dx = (weighted_uv_dx - texture_coord * sum_dx) * inverse_sum;
+            uv_dy = (weighted_uv_dy - texture_coord * sum_dy) * inverse_sum;
+        }
+        // interpolate normals, already in world space
+        vec3r normal(0, 0, 0);
+        if constexpr (Lit)
+            normal = (normals[0] * w0 +
+                      normals[1] * w1 +
+                      normals[2] * w2) *
+                     inverse_sum;
+        return shader.get_colour<Textured, Lit, Filter>(texture_coord, uv_dx, uv_dy, normal);
+    }
 
-                    // interpolate texture coordinates
-                    vector2 texture_coord(0, 0);
-                    if (model.shader.has_texture)
-                    {
-                        texture_coord = (model.texture_coords[i] * w0 +
-                                         model.texture_coords[i + 1] * w1 +
-                                         model.texture_coords[i + 2] * w2) *
-                                        (1 /
-                                         w_sum);
-                    }
-                    // interpolate normals
-                    vector3 normal = (model.normals[i] * w0 +
-                                      model.normals[i + 1] * w1 +
-                                      model.normals[i + 2] * w2) *
-                                     (1 / w_sum);
-
-                    
-                    image.pixels[get_index(x, y, image.width)] = model.shader.get_colour(texture_coord, model.transform.transform_normal(normal));
-                    image.depth[get_index(x, y, image.width)] = depth;
-                }
+    template <bool Textured, bool Lit, TextureFilter Filter>
+    static vec3r shade_variant(const CornerAttributes &attributes, const Shader &shader, real w0, real w1, real w2)
+    {
+        return attributes.shade<Textured, Lit, Filter>(shader, w0, w1, w2);
+    }
+};
+
+// a triangle's edge functions, facing so they are positive inside; a back face has its edges turned around
+// edge k is opposite corner k, e_k(p) = step_x * (p.x - from_x) + step_y * (p.y - from_y), and e_k / area is corner k's weight
+// the forward raster loop and the deferred shading pass both weigh pixels with at() and corner_weight, so they agree exactly
+struct TriangleEdges
+{
+    real step_x[3] = {}, step_y[3] = {}, from_x[3] = {}, from_y[3] = {};
+    real area = 0; // twice the triangle's, 0 when it's degenerate
+    real inverse_area = 0;
+    real corner_weight[3] = {}; // corner k's 1 / view depth over the area
+
+    TriangleEdges() {}
+    explicit TriangleEdges(const ScreenTriangle &tri)
+    {
+        const vec4r *corners[3] = {&tri.a, &tri.b, &tri.c};
+        for (int k = 0; k < 3; ++k)
+        {
+            const vec4r &from = *corners[(k + 1) % 3];
+            const vec4r &to = *corners[(k + 2) % 3];
+            step_x[k] = to.y() - from.y();
+            step_y[k] = from.x() - to.x();
+            from_x[k] = from.x();
+            from_y[k] = from.y();
+        }
+        area = at(0, tri.a.x(), tri.a.y());
+        if (area < 0)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                step_x[k] = -step_x[k];
+                step_y[k] = -step_y[k];
             }
+            area = -area;
         }
+        inverse_area = area != 0 ? 1 / area : 0;
+        for (int k = 0; k < 3; ++k)
+            corner_weight[k] = corners[k]->w() * inverse_area;
     }
-}
 
-void render_multithread(Model &model, Image &image, Camera cam)
+    real at(int k, real px, real py) const { return step_x[k] * (px - from_x[k]) + step_y[k] * (py - from_y[k]); }
+};
+
+// rasterizes the part of a triangle that falls inside [min_x, max_x) x [min_y, max_y)
+// the triangle is first tested whole against the Hi-Z, then 8x8 block by block: hidden blocks are skipped, blocks the
+// triangle is entirely in front of are drawn without depth tests, and the blocks it draws into get their bounds updated
+// edge functions are set up once and evaluated at each row's start for the SIMD span kernel to find the covered pixels
+// `clip` holds the corners' weights when the triangle is a piece of a clipped one, its attributes are blended from the source's
+// deferred, pixels that pass the depth test get `id` in the visibility buffer instead of a colour and are shaded later
+// compiled per pipeline state (see PipelineRegistry), `visibility` is only used when deferred
+template <bool Textured, bool Lit, TextureFilter Filter, DepthFormat Depth, bool Deferred>
+void rasterize_triangle(const ScreenTriangle &tri, const Draw &draw, const ScreenVertices &vertices, const CornerWeights *clip,
+                        RenderTarget &target, HiZBuffer &hiz, VisibilityBuffer *visibility, uint32_t id, RasterStats &stats,
+                        int min_x, int max_x, int min_y, int max_y)
 {
+    int start_x = std::max(tri.start_x, min_x);
+    int end_x = std::min(tri.end_x, max_x);
+    int start_y = std::max(tri.start_y, min_y);
+    int end_y = std::min(tri.end_y, max_y);
+    if (start_x >= end_x || start_y >= end_y)
+        return;
 
-    std::vector<std::thread> threads;
-    int total_points = model.points.size();
-    int points_per_thread = total_points / NUM_THREADS;
-    if (points_per_thread % 3 != 0)
+    // depth is tested as the keys of the reversed depth buffer, larger is nearer
+    const DepthEncoding &encoding = target.depth_encoding;
+    uint32_t nearest_key = encoding.encode<Depth>(std::max({tri.a.w(), tri.b.w(), tri.c.w()}) * (1 + HIZ_DEPTH_MARGIN));
+    uint32_t farthest_key = encoding.encode<Depth>(std::min({tri.a.w(), tri.b.w(), tri.c.w()}) * (1 - HIZ_DEPTH_MARGIN));
+    if (hiz.hides(start_x, start_y, end_x, end_y, nearest_key))
     {
-        points_per_thread -= points_per_thread % 3; // ensure we have complete triangles
+        ++stats.triangles_hidden;
+        return;
+    }
+
+    // setup only lets through the faces the draw shows
+    const TriangleEdges edges(tri);
+    if (edges.area == 0)
+        return;
+    const real inverse_area = edges.inverse_area;
+    EdgeRow row;
+    for (int k = 0; k < 3; ++k)
+    {
+        row.step[k] = static_cast<float>(edges.step_x[k]);
+        row.inclusive[k] = edges.step_x[k] > 0 || (edges.step_x[k] == 0 && edges.step_y[k] < 0);
     }
 
-    for (int t = 0; t < NUM_THREADS; ++t)
+    vec3r depths_inv(tri.a.w(), tri.b.w(), tri.c.w());
+    SpanKernel find_span = span_kernel().kernel;
+    const Shader &shader = *draw.shader;
+    CornerAttributes attributes;
+    if constexpr (!Deferred)
     {
-        int start = t * points_per_thread;
-        int end = (t == NUM_THREADS - 1) ? total_points : start + points_per_thread;
-        if (end % 3 != 0)
+        attributes.load(tri, draw, vertices, clip);
+        real weight_dx[3], weight_dy[3];
+        for (int k = 0; k < 3; ++k)
         {
-            end -= end % 3;
+            weight_dx[k] = edges.step_x[k] * edges.corner_weight[k];
+            weight_dy[k] = edges.step_y[k] * edges.corner_weight[k];
         }
-
-        threads.emplace_back(render_chunk, std::ref(model), std::ref(image), cam, start, end);
+        attributes.gradients(weight_dx, weight_dy);
     }
 
-    for (auto &thread : threads)
-        thread.join();
-}
-
-void render_basic(Model &model, Image &image, Transform transform, Camera cam, double fov)
-{
-    for (int i = 0; i < model.points.size(); i += 3)
+    // the rows are walked in bands of one Hi-Z block
+    const int MAX_BLOCKS = TILE_SIZE / HIZ_BLOCK;
+    int first_block = start_x / HIZ_BLOCK;
+    int block_count = (end_x - 1) / HIZ_BLOCK - first_block + 1;
+    for (int y = start_y; y < end_y;)
     {
-        vector3 a = world_to_screen(model.points[i], transform, cam, image.width, image.height);
-        vector3 b = world_to_screen(model.points[i + 1], transform, cam, image.width, image.height);
-        vector3 c = world_to_screen(model.points[i + 2], transform, cam, image.width, image.height);
-
-        double min_x = std::min({a.getX(), b.getX(), c.getX()});
-        double max_x = std::max({a.getX(), b.getX(), c.getX()});
-        double min_y = std::min({a.getY(), b.getY(), c.getY()});
-        double max_y = std::max({a.getY(), b.getY(), c.getY()});
+        int by = y / HIZ_BLOCK;
+        int band_end = std::min(end_y, (by + 1) * HIZ_BLOCK);
+
+        bool hidden[MAX_BLOCKS], accepted[MAX_BLOCKS];
+        int covered[MAX_BLOCKS];
+        uint32_t written_nearest[MAX_BLOCKS], band_farthest[MAX_BLOCKS];
+        int first_visible = block_count, last_visible = -1;
+        for (int b = 0; b < block_count; ++b)
+        {
+            hidden[b] = hiz.farthest(first_block + b, by) > nearest_key;
+            accepted[b] = !hidden[b] && farthest_key > hiz.nearest(first_block + b, by);
+            stats.blocks_hidden += hidden[b];
+            stats.blocks_accepted += accepted[b];
+            if (!hidden[b])
+            {
+                first_visible = std::min(first_visible, b);
+                last_visible = b;
+            }
+            covered[b] = 0;
+            written_nearest[b] = 0;
+            band_farthest[b] = UINT32_MAX;
+        }
+        if (last_visible < 0)
+        {
+            y = band_end;
+            continue;
+        }
 
-        // ensure triangle within the bounds of the pixel array
-        int start_x = clamp(static_cast<int>(min_x), 0, static_cast<int>(image.width - 1));
-        int end_x = clamp(static_cast<int>(ceil(max_x)), 0, static_cast<int>(image.width - 1));
+        // rows are searched only between the outermost visible blocks, and hidden blocks inside the span are stepped over whole
+        int band_start_x = std::max(start_x, (first_block + first_visible) * HIZ_BLOCK);
+        int band_end_x = std::min(end_x, (first_block + last_visible + 1) * HIZ_BLOCK);
+        for (; y < band_end; ++y)
+        {
+            real py = y + real(0.5);
+            for (int k = 0; k < 3; ++k)
+                row.e[k] = static_cast<float>(edges.at(k, band_start_x + real(0.5), py));
 
-        int start_y = clamp(static_cast<int>(min_y), 0, static_cast<int>(image.height - 1));
-        int end_y = clamp(static_cast<int>(ceil(max_y)), 0, static_cast<int>(image.height - 1));
+            int first = 0;
+            int run = find_span(row, band_end_x - band_start_x, first);
+            uint32_t *colors = target.row(y);
 
-        for (int y = start_y; y < end_y; ++y)
-        {
-            for (int x = start_x; x < end_x; ++x)
+            int span_end = band_start_x + first + run;
+            for (int x = band_start_x + first; x < span_end;)
             {
-                vector2 point(x, y);
-                vector3 weights(0, 0, 0);
-
-                if (point.insideTriangle(vector2(a.getX(), a.getY()), vector2(b.getX(), b.getY()), vector2(c.getX(), c.getY()), weights))
+                int b = x / HIZ_BLOCK - first_block;
+                int segment_end = std::min(span_end, (first_block + b + 1) * HIZ_BLOCK);
+                if (hidden[b])
                 {
-                    vector3 depths(a.getZ(), b.getZ(), c.getZ());
-                    vector3 depths_inv(1 / a.getZ(), 1 / b.getZ(), 1 / c.getZ());
-                    double depth = 1 / weights.dot(depths_inv);
+                    x = segment_end;
+                    continue;
+                }
+                covered[b] += segment_end - x;
 
-                    if (depth > image.depth[get_index(x, y, image.width)])
+                for (; x < segment_end; ++x)
+                {
+                    real px = x + real(0.5);
+                    real e0 = edges.at(0, px, py), e1 = edges.at(1, px, py), e2 = edges.at(2, px, py);
+                    vec3r weights(e0 * inverse_area, e1 * inverse_area, e2 * inverse_area);
+                    uint32_t depth = encoding.encode<Depth>(dot(weights, depths_inv));
+
+                    size_t pixel = get_index(x, y, target.width);
+                    uint32_t &stored = target.depth[pixel];
+                    if (!accepted[b] && depth < stored)
                     {
+                        band_farthest[b] = std::min(band_farthest[b], stored);
                         continue; // skip if the depth is not closer
                     }
-
-                    double w0 = weights.getX() * depths_inv.getX();
-                    double w1 = weights.getY() * depths_inv.getY();
-                    double w2 = weights.getZ() * depths_inv.getZ();
-                    double w_sum = w0 + w1 + w2;
-                    vector2 texture_coord(0, 0);
-                    if (model.shader.has_texture)
+                    band_farthest[b] = std::min(band_farthest[b], depth);
+                    written_nearest[b] = std::max(written_nearest[b], depth);
+                    stored = depth;
+                    if constexpr (Deferred)
+                        visibility->ids[pixel] = id;
+                    else
                     {
-                        texture_coord = (model.texture_coords[i] * w0 +
-                                         model.texture_coords[i + 1] * w1 +
-                                         model.texture_coords[i + 2] * w2) *
-                                        (1 /
-                                         w_sum);
+                        real w0 = e0 * edges.corner_weight[0];
+                        real w1 = e1 * edges.corner_weight[1];
+                        real w2 = e2 * edges.corner_weight[2];
+                        colors[x] = pack_color(attributes.shade<Textured, Lit, Filter>(shader, w0, w1, w2));
+                        ++stats.pixels_shaded;
                     }
-
-                    // interpolate normals
-                    vector3 normal = (model.normals[i] * w0 +
-                                      model.normals[i + 1] * w1 +
-                                      model.normals[i + 2] * w2) *
-                                     (1 / w_sum);
-
-                    image.pixels[get_index(x, y, image.width)] = model.shader.get_colour(texture_coord, normal);
-                    image.depth[get_index(x, y, image.width)] = depth;
                 }
             }
         }
-    }
-}
 
-void write_frame_rows(int startY, int endY, const Image &image, uint32_t *pixels)
-{
-    for (int y = startY; y < endY; ++y)
-    {
-        for (int x = 0; x < WIDTH; ++x)
+        // a block the triangle covered completely now holds exactly the depths seen, otherwise only its nearest bound can move
+        for (int b = 0; b < block_count; ++b)
         {
-            vector3 color = image.pixels[get_index(x, y, image.width)];
-            uint8_t r = color.getX();
-            uint8_t g = color.getY();
-            uint8_t b = color.getZ();
-            pixels[(HEIGHT - y - 1) * WIDTH + x] = (255 << 24) | (r << 16) | (g << 8) | b; // ARGB
+            if (covered[b] == 0)
+                continue;
+            int bx = first_block + b;
+            int pixels = (std::min((bx + 1) * HIZ_BLOCK, target.width) - bx * HIZ_BLOCK) *
+                         (std::min((by + 1) * HIZ_BLOCK, target.height) - by * HIZ_BLOCK);
+            uint32_t farthest = covered[b] == pixels ? band_farthest[b] : hiz.farthest(bx, by);
+            uint32_t nearest = std::max(hiz.nearest(bx, by), written_nearest[b]);
+            if (farthest != hiz.farthest(bx, by) || nearest != hiz.nearest(bx, by))
+                hiz.update(bx, by, nearest, farthest);
         }
     }
 }
 
-void frame_writer_multithread(const Image &image, uint32_t *pixels)
+// ==================== PipelineRegistry Class ====================
+// The raster loop and the deferred shading function compiled for every pipeline state, looked up once per draw.
+// States whose code can't differ share an entry: the filter without a texture, and everything but depth when deferred.
+class PipelineRegistry
 {
-    std::vector<std::thread> threads;
-    int rowsPerThread = HEIGHT / NUM_THREADS;
+public:
+    PipelineRegistry()
+    {
+        add_depth<DepthFormat::Float32>();
+        add_depth<DepthFormat::Fixed24>();
+    }
 
-    for (int i = 0; i < NUM_THREADS; ++i)
+    RasterizeFunction rasterizer(const PipelineState &state) const
     {
-        int startY = i * rowsPerThread;
-        int endY = (i == NUM_THREADS - 1) ? HEIGHT : startY + rowsPerThread;
-        threads.emplace_back(write_frame_rows, startY, endY, std::ref(image), pixels);
+        return rasterizers[static_cast<int>(state.depth) * VARIANTS + variant(state.deferred, state.textured, state.lit, state.filter)];
     }
 
-    for (auto &t : threads)
-        t.join();
-}
+    // how the deferred pass shades the draw's pixels
+    ShadeFunction shader(const PipelineState &state) const { return shaders[variant(false, state.textured, state.lit, state.filter)]; }
+
+private:
+    // per depth format: deferred, then untextured and textured with each filter, each unlit and lit
+    static const int VARIANTS = 9;
+    RasterizeFunction rasterizers[2 * VARIANTS];
+    ShadeFunction shaders[VARIANTS] = {}; // none for the deferred entry
 
-vector3 vertex_to_view(vector3 p, Transform transform, Camera cam)
+    static int variant(bool deferred, bool textured, bool lit, TextureFilter filter)
+    {
+        if (deferred)
+            return 0;
+        return (textured ? 3 + 2 * static_cast<int>(filter) : 1) + lit;
+    }
+
+    template <bool Textured, bool Lit, TextureFilter Filter, DepthFormat Depth, bool Deferred>
+    void add()
+    {
+        int v = variant(Deferred, Textured, Lit, Filter);
+        rasterizers[static_cast<int>(Depth) * VARIANTS + v] = &rasterize_triangle<Textured, Lit, Filter, Depth, Deferred>;
+        if constexpr (!Deferred)
+            shaders[v] = &CornerAttributes::shade_variant<Textured, Lit, Filter>;
+    }
+
+    template <TextureFilter Filter, DepthFormat Depth>
+    void add_textured()
+    {
+        add<true, false, Filter, Depth, false>();
+        add<true, true, Filter, Depth, false>();
+    }
+
+    template <DepthFormat Depth>
+    void add_depth()
+    {
+        add<false, false, TextureFilter::Nearest, Depth, true>();
+        add<false, false, TextureFilter::Nearest, Depth, false>();
+        add<false, true, TextureFilter::Nearest, Depth, false>();
+        add_textured<TextureFilter::Nearest, Depth>();
+        add_textured<TextureFilter::Bilinear, Depth>();
+        add_textured<TextureFilter::Trilinear, Depth>();
+    }
+};
+
+const PipelineRegistry &pipelines()
 {
-    vector3 vertex_world = transform.to_world_point(p);
-    vector3 vertex_view = cam.transform.to_local_point(vertex_world);
-    return vertex_view;
+    static const PipelineRegistry registry;
+    return registry;
 }
 
-void process_model(Model model, Camera cam)
+// assembles a contiguous range of the scene's triangles and bins them into the worker's lists
+// `first_triangle` holds the global index of each model's first triangle
+void bin_chunk(FrameContext &frame, const std::vector<int> &first_triangle, int worker, int start, int end)
 {
-    const size_t triangle_count = model.points.size() / 3;
-    const int num_threads = std::thread::hardware_concurrency();
-    const size_t triangles_per_thread = (triangle_count + num_threads - 1) / num_threads;
-
-    std::vector<std::thread> threads;
-    std::vector<std::vector<vector3>> thread_local_results(num_threads);
+    if (start >= end)
+        return;
 
-    auto worker = [&](int thread_id)
+    frame.bins.begin(worker, end - start);
+    int draw_index = std::upper_bound(first_triangle.begin(), first_triangle.end(), start) - first_triangle.begin() - 1;
+    for (int t = start; t < end; ++t)
     {
-        size_t start = thread_id * triangles_per_thread * 3;
-        size_t end = std::min(start + triangles_per_thread * 3, model.points.size());
+        while (t >= first_triangle[draw_index + 1])
+            ++draw_index;
 
-        std::vector<vector3> transformed_points(3);
+        int i = (frame.draws[draw_index].first_triangle + t - first_triangle[draw_index]) * 3;
+        bin_triangle(frame, worker, draw_index, i);
+    }
+}
 
-        for (size_t i = start; i + 2 < end; i += 3)
+// shades every pixel of a tile the visibility buffer holds a triangle for, once
+// the weights come from the same TriangleEdges rasterize_triangle used, evaluated the same way at the pixel centre
+void shade_tile(RenderTarget &target, FrameContext &frame, RasterStats &stats, int min_x, int max_x, int min_y, int max_y)
+{
+    const TileBins &bins = frame.bins;
+    const VisibilityBuffer &visibility = frame.visibility;
+    uint32_t current = 0;
+    const Shader *shader = nullptr;
+    ShadeFunction shade = nullptr;
+    CornerAttributes attributes;
+    TriangleEdges edges; // the current triangle's
+    for (int y = min_y; y < max_y; ++y)
+    {
+        uint32_t *colors = target.row(y);
+        for (int x = min_x; x < max_x; ++x)
         {
-            transformed_points[0] = vertex_to_view(model.points[i], model.transform, cam);
-            transformed_points[1] = vertex_to_view(model.points[i + 1], model.transform, cam);
-            transformed_points[2] = vertex_to_view(model.points[i + 2], model.transform, cam);
+            size_t pixel = get_index(x, y, target.width);
+            uint32_t id = visibility.ids[pixel];
+            if (id == 0)
+                continue;
+            // neighbouring pixels mostly show the same triangle
+            if (id != current)
+            {
+                int worker, index;
+                visibility.decode(id, worker, index);
+                const ScreenTriangle &tri = bins.triangle(worker, index);
+                const Draw &draw = frame.draws[tri.draw_index];
+                shader = draw.shader;
+                shade = frame.draw_shaders[tri.draw_index];
+                attributes.load(tri, draw, frame.vertices, tri.clipped >= 0 ? &bins.clip_weights(worker, tri.clipped) : nullptr);
+                edges = TriangleEdges(tri);
+                real weight_dx[3], weight_dy[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    weight_dx[k] = edges.step_x[k] * edges.corner_weight[k];
+                    weight_dy[k] = edges.step_y[k] * edges.corner_weight[k];
+                }
+                attributes.gradients(weight_dx, weight_dy);
+                current = id;
+            }
+
+            real px = x + real(0.5), py = y + real(0.5);
+            real w0 = edges.at(0, px, py) * edges.corner_weight[0];
+            real w1 = edges.at(1, px, py) * edges.corner_weight[1];
+            real w2 = edges.at(2, px, py) * edges.corner_weight[2];
+            colors[x] = pack_color(shade(attributes, *shader, w0, w1, w2));
+            ++stats.pixels_shaded;
+        }
+    }
+}
 
-            double clipping_distance = 0.01;
-            bool clip_1 = transformed_points[0].getZ() < clipping_distance;
-            bool clip_2 = transformed_points[1].getZ() < clipping_distance;
-            bool clip_3 = transformed_points[2].getZ() < clipping_distance;
+// rasterizes every triangle binned to one tile, in submission order
+// the tile's Hi-Z cells are read back from the depth buffer first, so they hold whatever the caller left in it
+// a pending depth clear is only carried out here, so tiles nothing is drawn into never touch their depth
+// in deferred mode the tile is rasterized into the visibility buffer and shaded once it's complete
+void render_tile(RenderTarget &target, FrameContext &frame, int tile)
+{
+    const TileBins &bins = frame.bins;
+    int min_x = (tile % bins.tiles_x) * TILE_SIZE;
+    int min_y = (tile / bins.tiles_x) * TILE_SIZE;
+    int max_x = std::min(min_x + TILE_SIZE, target.width);
+    int max_y = std::min(min_y + TILE_SIZE, target.height);
+
+    RasterStats &stats = frame.tile_stats[tile];
+    stats = RasterStats();
+    bool empty = true;
+    for (int w = 0; w < bins.worker_count() && empty; ++w)
+        empty = bins.tile(w, tile).empty();
+    if (empty)
+        return;
+    int tile_x = tile % bins.tiles_x, tile_y = tile / bins.tiles_x;
+    bool cleared = target.prepare_depth(tile_x, tile_y);
+    frame.hiz.build_tile(target, tile_x, tile_y, cleared);
+    VisibilityBuffer *visibility = frame.visibility.enabled ? &frame.visibility : nullptr;
+    if (visibility)
+        visibility->clear(min_x, max_x, min_y, max_y);
+
+    for (int w = 0; w < bins.worker_count(); ++w)
+    {
+        for (int index : bins.tile(w, tile))
+        {
+            const ScreenTriangle &tri = bins.triangle(w, index);
+            const CornerWeights *clip = tri.clipped >= 0 ? &bins.clip_weights(w, tri.clipped) : nullptr;
+            uint32_t id = visibility ? visibility->id(w, index) : 0;
+            frame.draw_rasterizers[tri.draw_index](tri, frame.draws[tri.draw_index], frame.vertices, clip, target, frame.hiz, visibility, id, stats,
+                               min_x, max_x, min_y, max_y);
+        }
+    }
+    if (visibility)
+        shade_tile(target, frame, stats, min_x, max_x, min_y, max_y);
+}
 
-            int clipped_count = (int)clip_1 + (int)clip_2 + (int)clip_3;
+// the frame's draws: the scene's objects (models, then every instance of every instanced model) go through the BVH,
+// which is refitted to their current transforms and walked with the view frustum and the occlusion buffer,
+// then through per-cluster culling, so off-screen and hidden geometry never reaches the vertex stage
+// draws are sorted nearest object first so the Hi-Z fills with occluders early; ties keep scene order,
+// so the image doesn't depend on the tree's shape
+void collect_draws(const Scene &scene, int width, int height, FrameContext &frame)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SceneObject> &objects = frame.objects;
+    objects.clear();
+    frame.occluder_objects.clear();
+    long long triangles = 0;
+    for (const Model &model : scene.models)
+    {
+        if (model.occluder && frame.occlusion.enabled)
+            frame.occluder_objects.push_back(static_cast<int>(objects.size()));
+        objects.push_back(SceneObject{model.mesh.get(), &model.shader, &model.transform.get_matrix(), model.occluder.get(), model.cull});
+        triangles += model.mesh->triangle_count();
+    }
+    for (const InstancedModel &batch : scene.instanced)
+    {
+        for (const mat4d &matrix : batch.matrices)
+        {
+            if (batch.occluder && frame.occlusion.enabled)
+                frame.occluder_objects.push_back(static_cast<int>(objects.size()));
+            objects.push_back(SceneObject{batch.mesh.get(), &batch.shader, &matrix, batch.occluder.get(), batch.cull,
+                                          batch.sized() ? &batch : nullptr});
+        }
+        triangles += static_cast<long long>(batch.mesh->triangle_count()) * batch.instance_count();
+    }
 
-            switch (clipped_count)
+    // a static scene keeps its tree untouched, anything moving refits it
+    SceneBvh &bvh = frame.bvh;
+    std::atomic<bool> moved(bvh.boxes.size() != objects.size());
+    bvh.boxes.resize(objects.size());
+    thread_pool().parallel_for(static_cast<int>(objects.size()), 1024, [&](int begin, int end)
+                               {
+                                   bool changed = false;
+                                   for (int o = begin; o < end; ++o)
+                                   {
+                                       WorldBox box = world_box(objects[o].mesh->bounds, *objects[o].matrix);
+                                       if (!(box == bvh.boxes[o]))
+                                       {
+                                           bvh.boxes[o] = box;
+                                           changed = true;
+                                       }
+                                   }
+                                   if (changed)
+                                       moved = true; });
+    if (moved)
+        bvh.update();
+
+    FrameStats &stats = frame.stats;
+    ViewSetup setup(scene.camera, width, height);
+    Frustum world = setup.frustum.transformed(setup.view);
+    mat4d view_projection = setup.projection * setup.view;
+
+    // occluders in view go into the occlusion buffer first
+    auto occluder_start = std::chrono::steady_clock::now();
+    OcclusionBuffer &occlusion = frame.occlusion;
+    occlusion.clear(static_cast<real>(scene.camera.near_plane));
+    for (int o : frame.occluder_objects)
+    {
+        const WorldBox &box = bvh.boxes[o];
+        if (world.test_box(box.min, box.max) == Visibility::Outside)
+            continue;
+        ++stats.occluders;
+        stats.occluder_triangles += occlusion.draw(*objects[o].occluder, mat4r(view_projection * *objects[o].matrix));
+    }
+    const OcclusionBuffer *occluders = occlusion.empty() ? nullptr : &occlusion;
+    if (occluders)
+        occlusion.finish();
+    stats.occluder_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - occluder_start).count();
+
+    // nodes the frustum keeps are tested against the occluders, which can hide a whole subtree at once
+    vec3r eye(scene.camera.transform.position);
+    frame.visible.clear();
+    bvh.query([&](const SceneBvh::Node &node, Visibility parent)
+              {
+                  ++stats.bvh_nodes_tested;
+                  Visibility visibility = parent == Visibility::Inside ? parent : world.test_box(node.box.min, node.box.max);
+                  if (visibility != Visibility::Outside && occluders && occluders->hides(node.box.min, node.box.max, view_projection))
+                  {
+                      stats.objects_occluded += node.count;
+                      for (int i = node.first; i < node.first + node.count; ++i)
+                          stats.triangles_occluded += objects[bvh.order[i]].mesh->triangle_count();
+                      return Visibility::Outside;
+                  }
+                  return visibility; },
+              [&](int object, Visibility visibility)
+              {
+                  // distance to the nearest point of the box, 0 from inside it
+                  const WorldBox &box = bvh.boxes[object];
+                  vec3r outside = max(max(box.min - eye, eye - box.max), vec3r(0));
+                  frame.visible.push_back(VisibleObject{dot(outside, outside), object, visibility}); });
+    std::sort(frame.visible.begin(), frame.visible.end(), [](const VisibleObject &a, const VisibleObject &b)
+              { return a.distance < b.distance || (a.distance == b.distance && a.object < b.object); });
+
+    // instances of models with LODs get the mesh their size on the screen calls for, or none
+    long long visible_triangles = 0;
+    real pixels_per_unit = static_cast<real>(setup.projection.col[0][0]);
+    frame.draws.clear();
+    for (const VisibleObject &visible : frame.visible)
+    {
+        SceneObject object = objects[visible.object];
+        if (object.batch)
+        {
+            const WorldBox &box = bvh.boxes[visible.object];
+            vec3r diagonal = box.max - box.min;
+            real distance = std::sqrt(visible.distance);
+            const Mesh *mesh = object.batch->mesh_for(distance > 0 ? std::sqrt(dot(diagonal, diagonal)) * pixels_per_unit / distance
+                                                                   : std::numeric_limits<double>::max());
+            if (!mesh)
             {
-            case 0:
-                thread_local_results[thread_id].push_back(transformed_points[0]);
-                thread_local_results[thread_id].push_back(transformed_points[1]);
-                thread_local_results[thread_id].push_back(transformed_points[2]);
-                break;
-            case 1:
-                // TODO: add clipping for one point and 2 points behind the camera
-                // int clipped_index = clip_1 ? 0 : (clip_2 ? 1 : 2);
-                // int other_index_1 = (clipped_index + 1) % 3;
-                // int other_index_2 = (clipped_index + 2) % 3;
-
-                // vector3 clipped_point = transformed_points[clipped_index];
-                // vector3 other_point_1 = transformed_points[other_index_1];
-                // vector3 other_point_2 = transformed_points[other_index_2];
-
-                // double a = (clipping_distance - clipped_point.getZ()) / (other_point_1.getZ() - clipped_point.getZ());
-                // double b = (clipping_distance - clipped_point.getZ()) / (other_point_2.getZ() - clipped_point.getZ());
-
-                // vector3 new_clipped_point_a = clipped_point.lerp(other_point_1, a);
-                // vector3 new_clipped_point_b = clipped_point.lerp(other_point_2, b);
-
-                break;
-            case 2:
-                // clipping logic (optional)
-                break;
-            default:
-                break;
+                ++stats.objects_culled;
+                ++stats.objects_small;
+                continue;
             }
+            stats.triangles_simplified += object.mesh->triangle_count() - mesh->triangle_count();
+            visible_triangles += object.mesh->triangle_count() - mesh->triangle_count();
+            object.mesh = mesh;
         }
-    };
-
-    for (int i = 0; i < num_threads; ++i)
-        threads.emplace_back(worker, i);
+        visible_triangles += object.mesh->triangle_count();
+        add_draws(object, setup, frame.draws, stats, visible.visibility, occluders);
+    }
 
-    for (auto &t : threads)
-        t.join();
+    // objects the tree rejected never reach add_draws
+    stats.objects += static_cast<int>(objects.size());
+    stats.objects_culled += static_cast<int>(objects.size() - frame.visible.size());
+    stats.triangles += triangles;
+    stats.triangles_culled += triangles - visible_triangles;
+    stats.cull_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-    std::vector<vector3> new_points;
-    for (auto &thread_result : thread_local_results)
-        new_points.insert(new_points.end(), thread_result.begin(), thread_result.end());
+// renders all models of the scene in three passes:
+// every shared vertex is transformed once, triangles are assembled from those, clipped where they need it
+// and binned into screen tiles, then every tile is rasterized by a single worker, so no two threads ever touch the same pixel
+// and the output doesn't depend on scheduling
+void render_scene(Scene &scene, RenderTarget &target, FrameContext &frame)
+{
+    ThreadPool &pool = thread_pool();
+
+    frame.stats.clear();
+    collect_draws(scene, target.width, target.height, frame);
+    prepare_vertex_stage(frame.draws, frame.vertices, frame.vertex_jobs, frame.vertex_order);
+    pool.parallel_for(static_cast<int>(frame.vertex_jobs.size()), 1, [&](int begin, int end)
+                      {
+                          for (int j = begin; j < end; ++j)
+                              run_vertex_job(frame.draws, frame.vertex_order, frame.vertices, frame.vertex_jobs[j]);
+                      });
+
+    std::vector<int> first_triangle(frame.draws.size() + 1, 0);
+    for (size_t d = 0; d < frame.draws.size(); ++d)
+        first_triangle[d + 1] = first_triangle[d] + frame.draws[d].triangle_count;
+    int total_triangles = first_triangle.back();
+
+    TileBins &bins = frame.bins;
+    bins.clear();
+    frame.clipper.fit(target.width, target.height, static_cast<real>(scene.camera.near_plane));
+    target.depth_encoding = DepthEncoding(target.depth_format, static_cast<real>(scene.camera.near_plane));
+    frame.draw_rasterizers.resize(frame.draws.size());
+    frame.draw_shaders.resize(frame.draws.size());
+    for (size_t d = 0; d < frame.draws.size(); ++d)
+    {
+        PipelineState state(frame.draws[d], target.depth_format, frame.visibility.enabled);
+        frame.draw_rasterizers[d] = pipelines().rasterizer(state);
+        frame.draw_shaders[d] = pipelines().shader(state);
+    }
+    std::fill(frame.setup_stats.begin(), frame.setup_stats.end(), SetupStats());
+    auto bin_start = std::chrono::steady_clock::now();
+    int slices = bins.worker_count();
+    int triangles_per_slice = (total_triangles + slices - 1) / slices;
+    pool.parallel_for(slices, 1, [&](int begin, int end)
+                      {
+                          for (int w = begin; w < end; ++w)
+                          {
+                              int start = std::min(w * triangles_per_slice, total_triangles);
+                              int stop = std::min(start + triangles_per_slice, total_triangles);
+                              bin_chunk(frame, first_triangle, w, start, stop);
+                          } });
+    frame.stats.bin_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bin_start).count();
+    frame.stats.triangles_clipped = bins.clipped_count();
+    for (const SetupStats &worker : frame.setup_stats)
+        frame.stats.add(worker);
+
+    pool.parallel_for(bins.tile_count(), 1, [&](int begin, int end)
+                      {
+                          for (int tile = begin; tile < end; ++tile)
+                              render_tile(target, frame, tile);
+                      });
+    for (const RasterStats &tile : frame.tile_stats)
+        frame.stats.add(tile);
 }
 
 Scene create_main_scene()
 {
-    std::vector<Model> models;
     vector3 SUN(0.3, 1, 0.6); // position of the sun in the scene
 
-    Model cube = load_object("objects/cube.obj", "textures/grass_block.bmp");
-    Model fox = load_object("objects/fox.obj", "textures/colMap.bytes");
-    Model dave = load_object("objects/dave.obj", "textures/daveTex.bytes");
-    Model floor = load_object("objects/floor.obj", "textures/tile.bmp");
-    Model tree_1 = load_object("objects/tree.obj", "textures/colMap.bytes");
-    Model tree_2 = load_object("objects/tree.obj", "textures/colMap.bytes");
-    Model dragon = load_object("objects/dragon.obj", "_no_texture", vector3(80, 255, 200));
-
-    Transform cube_transform(degrees_to_radians(75), degrees_to_radians(20), 0, vector3(7, 0.5, 3), vector3(1, 1, 1));
-    Transform fox_transform(0, 0, 0, vector3(0.5, 0, 3), vector3(1, 1, 1) * 0.2);
-    Transform dave_transform(0, 0, 0, vector3(0, 0, 3));
-    Transform floor_transform(0, 0, 0, vector3(0, 0, 5));
-    Transform tree_1_transform(0, 0, 0, vector3(-4, 0, 3));
-    Transform tree_2_transform(0, 0, 0, vector3(4, 0, 7));
-    Transform dragon_transform(0, 0, 0, vector3(0, 0, 7));
-
-    cube.transform = cube_transform;
-    fox.transform = fox_transform;
-    dave.transform = dave_transform;
-    floor.transform = floor_transform;
-    tree_1.transform = tree_1_transform;
-    tree_2.transform = tree_2_transform;
-    dragon.transform = dragon_transform;
+    struct ModelSource
+    {
+        std::string obj, texture;
+        vector3 base_color;
+        std::vector<Transform> transforms; // more than one makes it an instanced model
+        bool occluder = false;             // large and solid enough to hide things, drawn into the occlusion buffer
+        CullMode cull = CullMode::Back;    // None for open meshes, which show both sides
+    };
 
-    models.push_back(dragon);
-    models.push_back(cube);
-    models.push_back(fox);
-    models.push_back(dave);
-    models.push_back(floor);
-    models.push_back(tree_1);
-    models.push_back(tree_2);
+    // in draw order; instanced models are drawn after the others
+    std::vector<ModelSource> sources = {
+        {"objects/dragon.obj", "_no_texture", vector3(80, 255, 200), {Transform(0, 0, 0, vector3(0, 0, 7))}},
+        {"objects/cube.obj", "textures/grass.bmp", vector3(255, 255, 255), {Transform(degrees_to_radians(75), degrees_to_radians(20), 0, vector3(7, 0.5, 3), vector3(1, 1, 1))}, true},
+        {"objects/fox.obj", "textures/colMap.bytes", vector3(255, 255, 255), {Transform(0, 0, 0, vector3(0.5, 0, 3), vector3(1, 1, 1) * 0.2)}},
+        {"objects/dave.obj", "textures/daveTex.bytes", vector3(255, 255, 255), {Transform(0, 0, 0, vector3(0, 0, 3))}, true},
+        {"objects/floor.obj", "textures/tile.bmp", vector3(255, 255, 255), {Transform(0, 0, 0, vector3(0, 0, 5))}, true, CullMode::None},
+        {"objects/tree.obj", "textures/colMap.bytes", vector3(255, 255, 255), {Transform(0, 0, 0, vector3(-4, 0, 3)), Transform(0, 0, 0, vector3(4, 0, 7))}},
+    };
 
     Camera camera(60.0, Transform(0, 0, 0, vector3(0, 2, -2))); // camera with a field of view of 60 degrees
-    Scene scene(models, camera);
+    Scene scene({}, camera);
+
+    // every model loads on its own task, the scene is assembled once they're all in
+    std::vector<std::unique_ptr<Model>> loaded(sources.size());
+    TaskGraph graph;
+    TaskGraph::TaskId assemble = graph.add([&]()
+                                           {
+                                               for (size_t i = 0; i < sources.size(); ++i)
+                                               {
+                                                   if (sources[i].transforms.size() == 1)
+                                                       scene.addModel(*loaded[i]);
+                                                   else
+                                                       scene.addInstanced(InstancedModel(*loaded[i], sources[i].transforms));
+                                               }
+                                           });
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        TaskGraph::TaskId load = graph.add([&, i]()
+                                           {
+                                               const ModelSource &source = sources[i];
+                                               loaded[i] = std::make_unique<Model>(load_object(source.obj, source.texture, source.base_color));
+                                               loaded[i]->transform = source.transforms[0];
+                                               loaded[i]->cull = source.cull;
+                                               if (source.occluder)
+                                                   loaded[i]->occluder = loaded[i]->mesh;
+                                           });
+        graph.precede(load, assemble);
+    }
+    // textures decode on tasks of their own, alongside the meshes; a model asking for one still loading waits for it
+    std::vector<std::string> texture_paths;
+    for (const ModelSource &source : sources)
+        if (source.texture != "_no_texture" && std::find(texture_paths.begin(), texture_paths.end(), source.texture) == texture_paths.end())
+            texture_paths.push_back(source.texture);
+    std::vector<std::shared_ptr<const Texture>> textures(texture_paths.size()); // alive until the models hold them
+    for (size_t t = 0; t < texture_paths.size(); ++t)
+        graph.precede(graph.add([&, t]()
+                                { textures[t] = assets().texture(texture_paths[t]); }),
+                      assemble);
+    graph.run(thread_pool());
+
     return scene;
 }
 
@@ -374,7 +956,8 @@ void real_time_render()
 {
 
     Scene scene = create_rotation_scene();
-    Image image(WIDTH, HEIGHT);
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
@@ -386,20 +969,32 @@ void real_time_render()
     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
     SDL_SetRelativeMouseMode(SDL_TRUE); // enable relative mouse mode for better camera control
+    std::cout << "raster kernel: " << span_kernel().name << "\n";
+
+    // C starts and stops saving every frame to captures/, on a writer thread so the frame rate holds
+    ImageWriter captures;
+    ImageFormat capture_format = capture_format_setting();
+    bool capturing = false;
+    int captured = 0;
 
     bool running = true;
     SDL_Event e;
+    Uint32 stats_start = SDL_GetTicks();
+    int stats_frames = 0;
 
     while (running)
     {
-        image.clearDepth();                        // clear depth buffer for the next frame
-        image.clearPixels(vector3(135, 206, 235)); // clear pixel buffer for the next frame (with a sky color)
-
         int deltaX = 0, deltaY = 0;
         while (SDL_PollEvent(&e))
         {
             if (e.type == SDLK_ESCAPE || e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_q))
                 running = false;
+            else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_c)
+            {
+                capturing = !capturing;
+                if (capturing)
+                    std::filesystem::create_directories("captures");
+            }
             else if (e.type == SDL_MOUSEMOTION)
             {
                 deltaX = e.motion.xrel;
@@ -435,19 +1030,49 @@ void real_time_render()
 
         scene.camera.transform.position = scene.camera.transform.position + move_delta.normalize() * cam_speed;
 
-        for (size_t i = 0; i < scene.models.size(); ++i)
+        // the frame is drawn straight into the texture, or into the target's own memory and copied: when it's captured,
+        // since locked texture memory may be write-only and slow to read back, and when the texture can't be locked
+        void *texture_pixels = nullptr;
+        int texture_pitch = 0;
+        bool locked = !capturing && SDL_LockTexture(texture, nullptr, &texture_pixels, &texture_pitch) == 0;
+        if (locked)
+            target.attach(texture_pixels, texture_pitch);
+        target.clearDepth();                        // clear depth buffer for the next frame
+        target.clearPixels(vector3(135, 206, 235)); // clear pixel buffer for the next frame (with a sky color)
+
+        render_scene(scene, target, frame);
+        if (capturing)
+        {
+            char filename[64];
+            std::snprintf(filename, sizeof(filename), "captures/frame_%05d%s", captured++, image_extension(capture_format));
+            captures.submit(target, filename, capture_format);
+        }
+        if (locked)
+        {
+            target.detach();
+            SDL_UnlockTexture(texture);
+        }
+        else
+            SDL_UpdateTexture(texture, nullptr, target.row(HEIGHT - 1), WIDTH * sizeof(uint32_t));
+
+        // frame rate and culling in the title, refreshed every second
+        ++stats_frames;
+        if (SDL_GetTicks() - stats_start >= 1000)
         {
-            // this lags the whole thing lol
-            // process_model(scene.models[i], scene.camera);
-            render_multithread(scene.models[i], image, scene.camera);
+            const FrameStats &stats = frame.stats;
+            char title[200];
+            std::snprintf(title, sizeof(title), "Renderer - %d fps, culled %d/%d objects, %d/%d clusters, %.0f%% of triangles (%.0f%% occluded, %.2f ms)",
+                          stats_frames, stats.objects_culled, stats.objects, stats.clusters_culled, stats.clusters, stats.culled_fraction() * 100,
+                          stats.occluded_fraction() * 100, stats.cull_ms);
+            if (capturing)
+                std::snprintf(title + std::strlen(title), sizeof(title) - std::strlen(title), ", capturing (%d saved)", captures.written());
+            SDL_SetWindowTitle(window, title);
+            stats_start = SDL_GetTicks();
+            stats_frames = 0;
         }
 
         scene.models[0].transform.rotate(degrees_to_radians(1), 0, 0);
 
-        std::vector<uint32_t> pixels(WIDTH * HEIGHT);
-        frame_writer_multithread(image, pixels.data());
-
-        SDL_UpdateTexture(texture, nullptr, pixels.data(), WIDTH * sizeof(uint32_t));
         SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, texture, nullptr, nullptr);
         SDL_RenderPresent(renderer);
@@ -458,3 +1083,110 @@ void real_time_render()
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
+
+// what headless_render renders and where it goes
+struct HeadlessOptions
+{
+    std::string scene = "rotation"; // "rotation": the dragon turning in place, "main": the camera circling the main scene
+    int frames = 360;
+    int fps = 30; // only recorded in the stream
+    VideoFormat format = VideoFormat::Y4M;
+    std::string output = "-"; // a file, or "-" for stdout
+};
+
+// renders frames without a window and streams them out, reporting the sustained frame rate on stderr
+// the frame after each one is rendered while it's converted and written; returns false if anything failed
+bool headless_render(const HeadlessOptions &options)
+{
+    Scene scene;
+    std::function<void(Scene &, int)> animate; // moves the scene to the given frame
+    if (options.scene == "rotation")
+    {
+        scene = create_rotation_scene();
+        animate = [](Scene &scene, int)
+        { scene.models[0].transform.rotate(degrees_to_radians(1), 0, 0); };
+    }
+    else if (options.scene == "main")
+    {
+        scene = create_main_scene();
+        // one turn around the middle of the scene over the whole render, looking slightly down at it
+        animate = [frames = options.frames](Scene &scene, int f)
+        {
+            vector3 centre(0, 1, 5);
+            double radius = 12, height = 4;
+            double yaw = 2 * M_PI * f / std::max(frames, 1);
+            scene.camera.transform.set_rotation(yaw, -atan2(height - centre.getY(), radius), 0);
+            scene.camera.transform.position = centre + vector3(sin(yaw), 0, -cos(yaw)) * radius + vector3(0, height - centre.getY(), 0);
+        };
+        animate(scene, 0);
+    }
+    else
+    {
+        std::cerr << "unknown scene: " << options.scene << "\n";
+        return false;
+    }
+
+    // a reader that goes away, e.g. `| head`, makes writes fail instead of killing the process, so the loop below
+    // stops at the failed frame and still reports
+    std::signal(SIGPIPE, SIG_IGN);
+    std::FILE *out = options.output == "-" ? stdout : std::fopen(options.output.c_str(), "wb");
+    if (!out)
+    {
+        std::cerr << "couldn't open " << options.output << " for writing\n";
+        return false;
+    }
+
+    RenderTarget target(WIDTH, HEIGHT);
+    FrameContext frame(WIDTH, HEIGHT, thread_pool().concurrency());
+    FrameStream stream(out, options.format, WIDTH, HEIGHT, options.fps);
+    std::cerr << "raster kernel: " << span_kernel().name << ", " << options.frames << " frames of " << WIDTH << "x" << HEIGHT << "\n";
+
+    auto start = std::chrono::steady_clock::now();
+    auto report_start = start;
+    int report_frames = 0;
+    double render_ms = 0;
+    int rendered = 0;
+    for (int f = 0; f < options.frames; ++f)
+    {
+        uint32_t *pixels = stream.acquire();
+        if (!pixels)
+            break; // writing failed, e.g. the reading end of the pipe went away
+
+        auto render_start = std::chrono::steady_clock::now();
+        target.attach(pixels, WIDTH * sizeof(uint32_t));
+        target.clearDepth();
+        target.clearPixels(vector3(135, 206, 235));
+        render_scene(scene, target, frame);
+        target.detach();
+        render_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - render_start).count();
+        ++rendered;
+        stream.submit(pixels);
+        animate(scene, f + 1);
+
+        ++report_frames;
+        auto now = std::chrono::steady_clock::now();
+        if (now - report_start >= std::chrono::seconds(1))
+        {
+            std::cerr << "frame " << f + 1 << "/" << options.frames << ", "
+                      << report_frames / std::chrono::duration<double>(now - report_start).count() << " fps\n";
+            report_start = now;
+            report_frames = 0;
+        }
+    }
+    bool written = stream.finish();
+    if (out != stdout)
+        written = std::fclose(out) == 0 && written;
+
+    // sustained: wall time up to the last frame written, so a writer slower than the renderer shows
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int frames = std::max(rendered, 1);
+    char summary[300];
+    std::snprintf(summary, sizeof(summary),
+                  "%d frames in %.2f s, %.1f fps sustained (per frame: render %.2f ms, waiting for the writer %.2f ms, encode %.2f ms, write %.2f ms)\n",
+                  stream.frames_written, seconds, stream.frames_written / seconds, render_ms / frames, stream.wait_ms / frames,
+                  stream.encode_ms / frames, stream.write_ms / frames);
+    std::cerr << summary;
+    if (!written)
+        std::cerr << "couldn't write every frame to " << options.output << "\n";
+    return written;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include "vec.hpp"
+#include "tile_binner.hpp"
+
+// a colour with channels in 0..255 as a 32-bit ARGB8888 pixel, the format of the window's texture
+inline uint32_t pack_color(const vec3r &color)
+{
+    uint8_t r = color.x();
+    uint8_t g = color.y();
+    uint8_t b = color.z();
+    return (255u << 24) | (r << 16) | (g << 8) | b;
+}
+
+inline vec3r unpack_color(uint32_t pixel)
+{
+    return vec3r((pixel >> 16) & 255, (pixel >> 8) & 255, pixel & 255);
+}
+
+enum class DepthFormat
+{
+    Float32,
+    Fixed24
+};
+
+// RASTERIZER_DEPTH=fixed24 stores depth as 24-bit fixed point, float32 otherwise
+inline DepthFormat depth_format_setting()
+{
+    const char *setting = std::getenv("RASTERIZER_DEPTH");
+    return setting && std::string(setting) == "fixed24" ? DepthFormat::Fixed24 : DepthFormat::Float32;
+}
+
+const uint32_t DEPTH_FIXED_MAX = (1u << 24) - 1;
+
+// depth is stored reversed, as 1 / view depth: nearer is larger, 0 is infinitely far and is what a clear writes
+// 1 / depth is affine on the screen, so it's interpolated without a per-pixel reciprocal, and float keeps its precision
+// in the distance, where perspective crowds depths together
+// keys of both formats compare as plain unsigned integers
+struct DepthEncoding
+{
+    DepthFormat format = DepthFormat::Float32;
+    real scale = 1; // fixed point: the near plane maps to the top of the 24-bit range
+
+    DepthEncoding() {}
+    DepthEncoding(DepthFormat format, real near_plane)
+        : format(format), scale(format == DepthFormat::Fixed24 ? near_plane * real(DEPTH_FIXED_MAX) : real(1)) {}
+
+    // `Format` has to be this encoding's format; the raster loops are compiled per format
+    template <DepthFormat Format>
+    uint32_t encode(real inverse_depth) const
+    {
+        inverse_depth = std::max(inverse_depth, real(0));
+        if constexpr (Format == DepthFormat::Float32)
+            return std::bit_cast<uint32_t>(static_cast<float>(inverse_depth));
+        else
+            return static_cast<uint32_t>(std::min(inverse_depth * scale + real(0.5), real(DEPTH_FIXED_MAX)));
+    }
+
+    uint32_t encode(real inverse_depth) const
+    {
+        return format == DepthFormat::Float32 ? encode<DepthFormat::Float32>(inverse_depth) : encode<DepthFormat::Fixed24>(inverse_depth);
+    }
+};
+
+// ==================== RenderTarget Class ====================
+// What the rasterizer draws into: packed ARGB8888 colour plus a depth buffer of DepthEncoding keys.
+// The renderer counts rows from the bottom, the screen from the top, so colour rows are stored flipped and
+// the colour memory can be handed to SDL as it is. It is either owned or borrowed, e.g. from a locked
+// streaming texture, so a frame is rendered straight into the texture without a conversion pass.
+// Depth is cleared lazily: clearDepth only marks the TILE_SIZE tiles, and a tile is cleared when something is drawn into it.
+class RenderTarget
+{
+public:
+    int width, height;
+    int tiles_x;
+    std::vector<uint32_t> depth;        // bottom row first, get_index(x, y, width)
+    std::vector<uint8_t> depth_cleared; // per tile: cleared since it was last drawn into, its entries are stale
+    DepthFormat depth_format = depth_format_setting();
+    DepthEncoding depth_encoding; // for the current camera, set by render_scene
+
+    RenderTarget(int width = 0, int height = 0) : width(width), height(height)
+    {
+        tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+        storage.resize(width * height, pack_color(vec3r(0, 0, 0)));
+        depth.resize(width * height, 0);
+        depth_cleared.assign(tiles_x * ((height + TILE_SIZE - 1) / TILE_SIZE), 0);
+        detach();
+    }
+
+    RenderTarget(const RenderTarget &) = delete;
+    RenderTarget &operator=(const RenderTarget &) = delete;
+
+    // draws into `memory`, rows `pitch` bytes apart and top row first, until detach()
+    // whatever was there is undefined until the next clearPixels
+    void attach(void *memory, int pitch)
+    {
+        pixels = static_cast<uint32_t *>(memory);
+        row_pitch = pitch / static_cast<int>(sizeof(uint32_t));
+    }
+
+    // back to the target's own memory
+    void detach()
+    {
+        pixels = storage.data();
+        row_pitch = width;
+    }
+
+    // row y counted from the bottom
+    uint32_t *row(int y) { return pixels + static_cast<size_t>(height - 1 - y) * row_pitch; }
+    const uint32_t *row(int y) const { return pixels + static_cast<size_t>(height - 1 - y) * row_pitch; }
+
+    // pixels from the start of one row to the next
+    int pitch() const { return row_pitch; }
+
+    vec3r color(int x, int y) const { return unpack_color(row(y)[x]); }
+
+    // the colour rows, top row first, e.g. to compare two renders
+    std::vector<uint32_t> snapshot() const
+    {
+        std::vector<uint32_t> rows;
+        rows.reserve(width * height);
+        for (int y = height - 1; y >= 0; --y)
+            rows.insert(rows.end(), row(y), row(y) + width);
+        return rows;
+    }
+
+    void clearPixels(const vec3r &color = vec3r(0, 0, 0))
+    {
+        uint32_t packed = pack_color(color);
+        for (int y = 0; y < height; ++y)
+            std::fill(row(y), row(y) + width, packed);
+    }
+
+    void clearDepth()
+    {
+        std::fill(depth_cleared.begin(), depth_cleared.end(), 1);
+    }
+
+    // carries out a pending clear of one tile's depth before drawing into it; returns whether there was one
+    bool prepare_depth(int tile_x, int tile_y)
+    {
+        uint8_t &cleared = depth_cleared[tile_y * tiles_x + tile_x];
+        if (!cleared)
+            return false;
+        int min_x = tile_x * TILE_SIZE, max_x = std::min(min_x + TILE_SIZE, width);
+        for (int y = tile_y * TILE_SIZE; y < std::min((tile_y + 1) * TILE_SIZE, height); ++y)
+            std::fill(depth.begin() + y * width + min_x, depth.begin() + y * width + max_x, 0);
+        cleared = 0;
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> storage;
+    uint32_t *pixels = nullptr;
+    int row_pitch = 0; // in pixels
+};
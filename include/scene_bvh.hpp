@@ -0,0 +1,277 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include "vec.hpp"
+#include "mesh.hpp"
+#include "frustum.hpp"
+
+// world space box of one object
+struct WorldBox
+{
+    vec3r min, max;
+
+    vec3r centroid() const { return (min + max) * real(0.5); }
+
+    void grow(const WorldBox &other)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            min[k] = std::min(min[k], other.min[k]);
+            max[k] = std::max(max[k], other.max[k]);
+        }
+    }
+
+    real half_area() const
+    {
+        vec3r e = max - min;
+        return e.x() * e.y() + e.y() * e.z() + e.z() * e.x();
+    }
+
+    bool operator==(const WorldBox &other) const
+    {
+        for (int k = 0; k < 3; ++k)
+            if (min[k] != other.min[k] || max[k] != other.max[k])
+                return false;
+        return true;
+    }
+
+    static WorldBox empty()
+    {
+        real big = std::numeric_limits<real>::max();
+        return WorldBox{vec3r(big), vec3r(-big)};
+    }
+};
+
+// the box around a mesh's bounds after `model` moves them into world space
+inline WorldBox world_box(const Bounds &bounds, const mat4d &model)
+{
+    vec3d center = model.transform_point(vec3d((bounds.min + bounds.max) * real(0.5)));
+    vec3d extent((bounds.max - bounds.min) * real(0.5));
+    vec3d world_extent;
+    for (int row = 0; row < 3; ++row)
+        for (int k = 0; k < 3; ++k)
+            world_extent[row] += std::abs(model(row, k)) * extent[k];
+    return WorldBox{vec3r(center - world_extent), vec3r(center + world_extent)};
+}
+
+// ==================== SceneBvh Class ====================
+// Bounding volume hierarchy over the scene's objects, built top-down with binned SAH.
+// Refit keeps the tree and only recomputes boxes, which is enough while objects move a little; the tree is
+// rebuilt when the object count changes or refits have made it much worse than a fresh build would be.
+class SceneBvh
+{
+public:
+    struct Node
+    {
+        WorldBox box;
+        int first, count; // the objects under the node are order[first, first + count)
+        int left;         // index of the left child, the right one follows it; -1 for leaves
+
+        bool leaf() const { return left < 0; }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> order;      // object indices, every subtree's objects next to each other
+    std::vector<WorldBox> boxes; // one per object, written by the caller before build, refit or update
+
+    void build()
+    {
+        order.resize(boxes.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = static_cast<int>(i);
+        nodes.clear();
+        if (boxes.empty())
+            return;
+        centroids.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); ++i)
+            centroids[i] = boxes[i].centroid();
+        nodes.reserve(2 * boxes.size());
+        nodes.push_back(Node{});
+        split(0, 0, static_cast<int>(boxes.size()));
+        built_cost = cost();
+    }
+
+    // same objects, new boxes: recompute every node's box bottom-up and keep the tree
+    void refit()
+    {
+        // children always come after their parent, so walking backwards reaches them first
+        for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; --n)
+        {
+            Node &node = nodes[n];
+            node.box = WorldBox::empty();
+            if (node.leaf())
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                    node.box.grow(boxes[order[i]]);
+            }
+            else
+            {
+                node.box.grow(nodes[node.left].box);
+                node.box.grow(nodes[node.left + 1].box);
+            }
+        }
+    }
+
+    // refits when it can, rebuilds when the number of objects changed or refits left the tree too loose
+    void update()
+    {
+        if (order.size() != boxes.size() || nodes.empty())
+        {
+            build();
+            return;
+        }
+        refit();
+        if (cost() > 2 * built_cost)
+            build();
+    }
+
+    // walks the tree: `test(node, parent)` classifies a node given what its parent tested as, and `visit(object, visibility)`
+    // gets every object under a leaf that isn't Outside; a test can skip work below a node its parent found Inside
+    template <typename Test, typename Visit>
+    void query(Test &&test, Visit &&visit) const
+    {
+        if (nodes.empty())
+            return;
+        int stack[64];
+        Visibility stack_state[64];
+        int top = 0;
+        stack[top] = 0;
+        stack_state[top++] = Visibility::Intersecting;
+        while (top > 0)
+        {
+            --top;
+            const Node &node = nodes[stack[top]];
+            Visibility state = test(node, stack_state[top]);
+            if (state == Visibility::Outside)
+                continue;
+            // a degenerate tree deeper than the stack hands out the rest of the subtree untested
+            if (node.leaf() || top + 2 > 64)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                    visit(order[i], state);
+                continue;
+            }
+            stack[top] = node.left + 1;
+            stack_state[top++] = state;
+            stack[top] = node.left;
+            stack_state[top++] = state;
+        }
+    }
+
+    // SAH cost of the tree relative to its root, used to notice when refits have degraded it
+    real cost() const
+    {
+        if (nodes.empty() || nodes[0].box.half_area() <= 0)
+            return 0;
+        real total = 0;
+        for (const Node &node : nodes)
+            total += node.box.half_area() * (node.leaf() ? node.count : 1);
+        return total / nodes[0].box.half_area();
+    }
+
+private:
+    static const int BINS = 12;
+    static const int MAX_LEAF = 4;
+    real built_cost = 0;
+    std::vector<vec3r> centroids; // of `boxes`, while building
+
+    void split(int node_index, int first, int count)
+    {
+        WorldBox box = WorldBox::empty(), centroid_box = WorldBox::empty();
+        for (int i = first; i < first + count; ++i)
+        {
+            box.grow(boxes[order[i]]);
+            centroid_box.grow(WorldBox{centroids[order[i]], centroids[order[i]]});
+        }
+        nodes[node_index] = Node{box, first, count, -1};
+        if (count <= 1)
+            return;
+
+        // best split between BINS buckets along the axis the centroids spread the most on, by surface area heuristic
+        int axis = 0;
+        vec3r spread = centroid_box.max - centroid_box.min;
+        if (spread[1] > spread[axis])
+            axis = 1;
+        if (spread[2] > spread[axis])
+            axis = 2;
+        real low = centroid_box.min[axis], scale = spread[axis] > 0 ? BINS / spread[axis] : 0;
+        int best_split = 0;
+        real best_cost = std::numeric_limits<real>::max();
+        if (scale > 0)
+        {
+            WorldBox bin_box[BINS];
+            int bin_count[BINS] = {};
+            for (int b = 0; b < BINS; ++b)
+                bin_box[b] = WorldBox::empty();
+            for (int i = first; i < first + count; ++i)
+            {
+                int b = bin_of(centroids[order[i]][axis], low, scale);
+                bin_box[b].grow(boxes[order[i]]);
+                ++bin_count[b];
+            }
+
+            // areas and counts of everything right of each split, then sweep from the left
+            real right_area[BINS];
+            int right_count[BINS];
+            WorldBox right = WorldBox::empty();
+            int right_total = 0;
+            for (int b = BINS - 1; b > 0; --b)
+            {
+                right.grow(bin_box[b]);
+                right_total += bin_count[b];
+                right_area[b] = right_total ? right.half_area() : 0;
+                right_count[b] = right_total;
+            }
+            WorldBox left = WorldBox::empty();
+            int left_total = 0;
+            for (int b = 1; b < BINS; ++b)
+            {
+                left.grow(bin_box[b - 1]);
+                left_total += bin_count[b - 1];
+                if (left_total == 0 || right_count[b] == 0)
+                    continue;
+                real split_cost = left.half_area() * left_total + right_area[b] * right_count[b];
+                if (split_cost < best_cost)
+                {
+                    best_cost = split_cost;
+                    best_split = b;
+                }
+            }
+        }
+
+        // stay a leaf when splitting doesn't pay for testing the two children first
+        real leaf_cost = box.half_area() * count;
+        if (best_split > 0 && count <= MAX_LEAF && best_cost + box.half_area() >= leaf_cost)
+            return;
+        if (best_split == 0)
+        {
+            // all centroids coincide: split down the middle so leaves stay small
+            if (count > MAX_LEAF)
+                split_children(node_index, first, count / 2, count);
+            return;
+        }
+
+        int *middle = std::partition(order.data() + first, order.data() + first + count, [&](int object)
+                                     { return bin_of(centroids[object][axis], low, scale) < best_split; });
+        split_children(node_index, first, static_cast<int>(middle - order.data()) - first, count);
+    }
+
+    void split_children(int node_index, int first, int left_count, int count)
+    {
+        int left = static_cast<int>(nodes.size());
+        nodes.push_back(Node{});
+        nodes.push_back(Node{});
+        nodes[node_index].left = left;
+        split(left, first, left_count);
+        split(left + 1, first + left_count, count - left_count);
+    }
+
+    static int bin_of(real value, real low, real scale)
+    {
+        int b = static_cast<int>((value - low) * scale);
+        return std::clamp(b, 0, BINS - 1);
+    }
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include "vec.hpp"
+#include "image_decoder.hpp"
+
+enum class TextureFilter
+{
+    Nearest,  // the nearest texel of the full size texture, no mip maps
+    Bilinear, // the four nearest texels of the nearest mip level
+    Trilinear // bilinear on the two nearest mip levels, blended
+};
+
+// RASTERIZER_FILTER=nearest or bilinear picks a cheaper texture filter, trilinear otherwise
+inline TextureFilter texture_filter_setting()
+{
+    const char *setting = std::getenv("RASTERIZER_FILTER");
+    if (setting && std::string(setting) == "nearest")
+        return TextureFilter::Nearest;
+    if (setting && std::string(setting) == "bilinear")
+        return TextureFilter::Bilinear;
+    return TextureFilter::Trilinear;
+}
+
+// texels are stored in square blocks of this many per side, 4x4 RGBA8 texels being one 64 byte cache line,
+// so the texels a filter reads together sit in one or two lines instead of one per row
+const int TEXTURE_BLOCK = 4;
+
+inline vec3r unpack_texel(uint32_t texel)
+{
+    return vec3r(texel & 255, (texel >> 8) & 255, (texel >> 16) & 255);
+}
+
+// a + (b - a) * weight / 256 on all four channels at once, weight in 0..256
+// two channels share a 32-bit multiply, each in its own 16 bits, which 255 * 256 doesn't overflow
+inline uint32_t lerp_texels(uint32_t a, uint32_t b, uint32_t weight)
+{
+    uint32_t red_blue = (((a & 0x00FF00FF) * (256 - weight) + (b & 0x00FF00FF) * weight) >> 8) & 0x00FF00FF;
+    uint32_t green_alpha = (((a >> 8) & 0x00FF00FF) * (256 - weight) + ((b >> 8) & 0x00FF00FF) * weight) & 0xFF00FF00;
+    return red_blue | green_alpha;
+}
+
+// ==================== Texture Class ====================
+// A texture converted at load into a chain of RGBA8 mip levels, each half the size of the one before, down to 1x1.
+// Levels are stored block by block (see TEXTURE_BLOCK), and sampled with texture coordinates in 0..1, clamped to the edges.
+// The mip level comes from how fast the texture coordinates change across the screen at the pixel.
+class Texture
+{
+public:
+    struct MipLevel
+    {
+        int width, height;
+        int blocks_x; // blocks per row
+        size_t offset; // of the level's first texel
+    };
+
+    std::string filename;
+    int width = 0, height = 0; // of level 0
+    std::vector<MipLevel> levels;
+
+    Texture(const std::string &filename) : filename(filename)
+    {
+        DecodedImage image = decode_image(filename);
+        build(image.width, image.height, std::move(image.pixels));
+    }
+
+    // the nearest texel of level 0
+    inline vec3r get_color(real u, real v) const
+    {
+        u = std::clamp(u, real(0), real(1));
+        v = std::clamp(v, real(0), real(1));
+        int x = static_cast<int>(u * (width - 1));
+        int y = static_cast<int>(v * (height - 1));
+        return unpack_texel(texel(levels[0], x, y));
+    }
+
+    // the colour at `uv` for a pixel whose texture coordinates change by `dx` and `dy` one pixel to the right and up
+    template <TextureFilter Filter>
+    vec3r sample(const vec2r &uv, const vec2r &dx, const vec2r &dy) const
+    {
+        if constexpr (Filter == TextureFilter::Nearest)
+            return get_color(uv.x(), uv.y());
+
+        // the level where a pixel step moves about one texel: log2 of the longer step in level 0 texels
+        real dux = dx.x() * width, dvx = dx.y() * height;
+        real duy = dy.x() * width, dvy = dy.y() * height;
+        real step = std::max(dux * dux + dvx * dvx, duy * duy + dvy * dvy);
+        real lod = step > 1 ? real(0.5) * std::log2(step) : real(0); // magnified: level 0
+        lod = std::min(lod, static_cast<real>(levels.size() - 1));
+
+        if constexpr (Filter == TextureFilter::Bilinear)
+            return unpack_texel(bilinear(levels[static_cast<int>(lod + real(0.5))], uv.x(), uv.y()));
+        int level = static_cast<int>(lod);
+        uint32_t blend = static_cast<uint32_t>((lod - level) * 256);
+        uint32_t color = bilinear(levels[level], uv.x(), uv.y());
+        if (blend > 0)
+            color = lerp_texels(color, bilinear(levels[level + 1], uv.x(), uv.y()), blend);
+        return unpack_texel(color);
+    }
+
+private:
+    std::vector<uint32_t> texels; // every level, one after the other
+
+    // a texel's index is the sum of a part from its column and one from its row
+    static size_t column_offset(int x) { return (x / TEXTURE_BLOCK) * TEXTURE_BLOCK * TEXTURE_BLOCK + x % TEXTURE_BLOCK; }
+    static size_t row_offset(const MipLevel &level, int y)
+    {
+        return static_cast<size_t>(y / TEXTURE_BLOCK) * level.blocks_x * TEXTURE_BLOCK * TEXTURE_BLOCK + (y % TEXTURE_BLOCK) * TEXTURE_BLOCK;
+    }
+
+    uint32_t texel(const MipLevel &level, int x, int y) const { return texels[level.offset + row_offset(level, y) + column_offset(x)]; }
+
+    // the four texels around (u, v), weighted by how close their centres are, in steps of 1/256
+    uint32_t bilinear(const MipLevel &level, real u, real v) const
+    {
+        // in 1/256 texels, offset by half a texel so the texel centres land on whole texels
+        int s = static_cast<int>(std::clamp(u, real(0), real(1)) * (level.width * 256)) - 128;
+        int t = static_cast<int>(std::clamp(v, real(0), real(1)) * (level.height * 256)) - 128;
+        int x0 = s >> 8, y0 = t >> 8; // rounds down, also below 0
+        uint32_t fx = s & 255, fy = t & 255;
+        int x1 = std::min(x0 + 1, level.width - 1), y1 = std::min(y0 + 1, level.height - 1);
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+
+        const uint32_t *bottom_row = &texels[level.offset + row_offset(level, y0)];
+        const uint32_t *top_row = &texels[level.offset + row_offset(level, y1)];
+        size_t left = column_offset(x0), right = column_offset(x1);
+        uint32_t bottom = lerp_texels(bottom_row[left], bottom_row[right], fx);
+        uint32_t top = lerp_texels(top_row[left], top_row[right], fx);
+        return lerp_texels(bottom, top, fy);
+    }
+
+    // the mip chain from row-major level 0 texels, each level a 2x2 box filter of the one before
+    void build(int base_width, int base_height, std::vector<uint32_t> pixels)
+    {
+        width = base_width;
+        height = base_height;
+        levels.clear();
+        texels.clear();
+        if (width == 0 || height == 0)
+            return;
+        int w = width, h = height;
+        size_t total = 0;
+        for (int lw = w, lh = h;; lw = std::max(lw / 2, 1), lh = std::max(lh / 2, 1))
+        {
+            levels.push_back(MipLevel{lw, lh, (lw + TEXTURE_BLOCK - 1) / TEXTURE_BLOCK, total});
+            total += static_cast<size_t>(levels.back().blocks_x) * ((lh + TEXTURE_BLOCK - 1) / TEXTURE_BLOCK) * TEXTURE_BLOCK * TEXTURE_BLOCK;
+            if (lw == 1 && lh == 1)
+                break;
+        }
+        texels.resize(total);
+
+        for (const MipLevel &level : levels)
+        {
+            // partial blocks at the right and top edges are padded with the edge texels
+            int padded_w = level.blocks_x * TEXTURE_BLOCK;
+            int padded_h = (h + TEXTURE_BLOCK - 1) / TEXTURE_BLOCK * TEXTURE_BLOCK;
+            for (int y = 0; y < padded_h; ++y)
+            {
+                const uint32_t *from = &pixels[static_cast<size_t>(std::min(y, h - 1)) * w];
+                uint32_t *to = &texels[level.offset + row_offset(level, y)];
+                for (int x = 0; x < padded_w; ++x)
+                    to[column_offset(x)] = from[std::min(x, w - 1)];
+            }
+            if (w == 1 && h == 1)
+                break;
+
+            // each texel of the next level averages four, all channels at once: two per 32 bits, 10 of their 16 bits used
+            int next_w = std::max(w / 2, 1), next_h = std::max(h / 2, 1);
+            std::vector<uint32_t> next(static_cast<size_t>(next_w) * next_h);
+            for (int y = 0; y < next_h; ++y)
+            {
+                const uint32_t *row0 = &pixels[static_cast<size_t>(std::min(2 * y, h - 1)) * w];
+                const uint32_t *row1 = &pixels[static_cast<size_t>(std::min(2 * y + 1, h - 1)) * w];
+                for (int x = 0; x < next_w; ++x)
+                {
+                    int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                    uint32_t a = row0[x0], b = row0[x1], c = row1[x0], d = row1[x1];
+                    uint32_t red_blue = (a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002;
+                    uint32_t green_alpha = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) + ((c >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF) + 0x00020002;
+                    next[static_cast<size_t>(y) * next_w + x] = ((red_blue >> 2) & 0x00FF00FF) | ((green_alpha << 6) & 0xFF00FF00);
+                }
+            }
+            pixels = std::move(next);
+            w = next_w;
+            h = next_h;
+        }
+    }
+};
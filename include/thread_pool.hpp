@@ -0,0 +1,324 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+
+// ==================== ThreadPool Class ====================
+// Long-lived workers, each with its own deque of tasks.
+// A worker pops from the back of its own deque and steals from the front of the others when it runs dry.
+// Threads that wait on pool work (parallel_for, TaskGraph::run) keep running tasks instead of blocking,
+// so parallel stages can be nested freely.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int workers = std::thread::hardware_concurrency() - 1)
+    {
+        workers = std::max(workers, 0);
+        // one extra queue for tasks pushed by threads outside the pool
+        for (int i = 0; i <= workers; ++i)
+            queues.emplace_back(new WorkerQueue());
+        for (int i = 0; i < workers; ++i)
+            threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // background workers, not counting the threads that help while waiting
+    int worker_count() const { return static_cast<int>(threads.size()); }
+
+    // maximum number of threads that can run a parallel_for at once
+    int concurrency() const { return worker_count() + 1; }
+
+    void submit(std::function<void()> task)
+    {
+        WorkerQueue &queue = *queues[current_queue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.lock);
+            queue.tasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleep_lock);
+        }
+        wake.notify_one();
+    }
+
+    // runs one pending task on the calling thread, returns false if there was none
+    bool run_pending_task()
+    {
+        std::function<void()> task;
+        if (!take_task(current_queue(), task))
+            return false;
+        task();
+        return true;
+    }
+
+    // calls fn(begin, end) over [0, count) in chunks of `grain`, on as many threads as there are chunks
+    // blocks until every chunk is done; the calling thread takes chunks too
+    // if fn throws, the remaining chunks are skipped and the first exception is rethrown here
+    template <typename F>
+    void parallel_for(int count, int grain, F &&fn)
+    {
+        if (count <= 0)
+            return;
+        grain = std::max(grain, 1);
+        int chunks = (count + grain - 1) / grain;
+        int helpers = std::min(chunks - 1, worker_count());
+        if (helpers <= 0)
+        {
+            fn(0, count);
+            return;
+        }
+
+        std::atomic<int> next(0);
+        std::atomic<int> active(helpers);
+        std::mutex error_lock;
+        std::exception_ptr error;
+        auto claim_chunks = [&]()
+        {
+            try
+            {
+                for (int begin = next.fetch_add(grain); begin < count; begin = next.fetch_add(grain))
+                    fn(begin, std::min(begin + grain, count));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(error_lock);
+                if (!error)
+                    error = std::current_exception();
+                next.store(count);
+            }
+        };
+
+        for (int h = 0; h < helpers; ++h)
+            submit([&]()
+                   {
+                       claim_chunks();
+                       active.fetch_sub(1);
+                   });
+
+        claim_chunks();
+        while (active.load() > 0)
+        {
+            if (!run_pending_task())
+                std::this_thread::yield();
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> queued{0};
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static int &worker_index()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    int current_queue() const
+    {
+        int index = worker_index();
+        return index >= 0 && index < worker_count() ? index : worker_count();
+    }
+
+    bool take_task(int own, std::function<void()> &task)
+    {
+        if (queued.load() == 0)
+            return false;
+
+        {
+            WorkerQueue &queue = *queues[own];
+            std::lock_guard<std::mutex> lock(queue.lock);
+            if (!queue.tasks.empty())
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+
+        int count = static_cast<int>(queues.size());
+        for (int offset = 1; offset < count; ++offset)
+        {
+            WorkerQueue &victim = *queues[(own + offset) % count];
+            std::lock_guard<std::mutex> lock(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(int index)
+    {
+        worker_index() = index;
+        std::function<void()> task;
+        while (true)
+        {
+            if (take_task(index, task))
+            {
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_lock);
+            wake.wait(lock, [this]()
+                      { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0)
+                return;
+        }
+    }
+};
+
+// the process-wide pool used by every parallel stage
+ThreadPool &thread_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+// ==================== TaskGraph Class ====================
+// A set of tasks with dependencies, run on a ThreadPool.
+// A task is queued once all the tasks it depends on are done; the graph can be run again after it completes.
+class TaskGraph
+{
+public:
+    using TaskId = int;
+
+    TaskId add(std::function<void()> fn)
+    {
+        nodes.emplace_back(new Node());
+        nodes.back()->fn = std::move(fn);
+        return static_cast<TaskId>(nodes.size() - 1);
+    }
+
+    // `after` only starts once `before` has finished
+    void precede(TaskId before, TaskId after)
+    {
+        nodes[before]->successors.push_back(after);
+        nodes[after]->dependencies++;
+    }
+
+    TaskId add(std::function<void()> fn, const std::vector<TaskId> &dependencies)
+    {
+        TaskId id = add(std::move(fn));
+        for (TaskId dependency : dependencies)
+            precede(dependency, id);
+        return id;
+    }
+
+    // runs the whole graph and blocks until it's done
+    // rethrows the first exception thrown by a task (its successors are skipped)
+    void run(ThreadPool &pool)
+    {
+        remaining.store(static_cast<int>(nodes.size()));
+        error = nullptr;
+        for (auto &node : nodes)
+        {
+            node->pending.store(node->dependencies);
+            node->failed.store(false);
+        }
+
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            if (nodes[i]->dependencies == 0)
+                schedule(pool, static_cast<TaskId>(i));
+        }
+
+        while (remaining.load() > 0)
+        {
+            if (!pool.run_pending_task())
+                std::this_thread::yield();
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    struct Node
+    {
+        std::function<void()> fn;
+        std::vector<TaskId> successors;
+        int dependencies = 0;
+        std::atomic<int> pending{0};
+        std::atomic<bool> failed{false};
+    };
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::atomic<int> remaining{0};
+    std::mutex error_lock;
+    std::exception_ptr error;
+
+    void schedule(ThreadPool &pool, TaskId id)
+    {
+        pool.submit([this, &pool, id]()
+                    { execute(pool, id); });
+    }
+
+    void execute(ThreadPool &pool, TaskId id)
+    {
+        Node &node = *nodes[id];
+        if (!node.failed.load())
+        {
+            try
+            {
+                node.fn();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_lock);
+                if (!error)
+                    error = std::current_exception();
+                node.failed.store(true);
+            }
+        }
+
+        for (TaskId successor : node.successors)
+        {
+            if (node.failed.load())
+                nodes[successor]->failed.store(true);
+            if (nodes[successor]->pending.fetch_sub(1) == 1)
+                schedule(pool, successor);
+        }
+        remaining.fetch_sub(1);
+    }
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <algorithm>
+#include "vec.hpp"
+
+const int TILE_SIZE = 32;
+
+// a projected triangle, ready to be rasterized
+struct ScreenTriangle
+{
+    vec4r a, b, c;                      // screen x, y, view depth and 1 / view depth of each corner
+    int draw_index;                     // index into the frame's draws
+    int first_corner;                   // index of the first corner in the mesh's index buffer
+    int clipped;                        // pieces of clipped triangles: index into the worker's clip_weights, otherwise -1
+    int start_x, end_x, start_y, end_y; // clamped pixel bounds (end is exclusive)
+};
+
+// the corners of a piece of a clipped triangle, as weights over the corners of the mesh triangle it was cut from
+struct CornerWeights
+{
+    vec3r corner[3];
+};
+
+// ==================== TileBins Class ====================
+// Screen-space triangles sorted into TILE_SIZE x TILE_SIZE tiles.
+// Every worker bins a contiguous slice of the frame's triangles into its own lists,
+// so walking the lists in worker order visits a tile's triangles in submission order.
+// Nothing is appended: every array keeps its size across frames and is written by index up to a count,
+// the triangles sized up front for the worker's slice by begin(), and any list that runs out doubled.
+class TileBins
+{
+public:
+    int width, height;
+    int tiles_x, tiles_y;
+
+    TileBins(int width = 0, int height = 0, int workers = 1) : width(width), height(height)
+    {
+        tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+        tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+        lists.resize(std::max(workers, 1));
+        for (WorkerLists &list : lists)
+        {
+            list.tiles.resize(tile_count());
+            list.tile_counts.assign(tile_count(), 0);
+        }
+    }
+
+    int worker_count() const { return static_cast<int>(lists.size()); }
+    int tile_count() const { return tiles_x * tiles_y; }
+
+    // empties every worker's lists; keeps the allocations around for the next frame
+    void clear()
+    {
+        for (WorkerLists &list : lists)
+        {
+            list.triangle_count = 0;
+            list.clipped_count = 0;
+            std::fill(list.tile_counts.begin(), list.tile_counts.end(), 0);
+        }
+    }
+
+    // makes room for a worker's slice of `count` triangles; clipped pieces past that grow the array
+    void begin(int worker, int count)
+    {
+        WorkerLists &list = lists[worker];
+        if (list.triangles.size() < static_cast<size_t>(count))
+            list.triangles.resize(count);
+    }
+
+    // bins a piece of a clipped triangle, keeping its corners' weights for the rasterizer
+    void add_clipped(int worker, ScreenTriangle tri, const CornerWeights &weights)
+    {
+        if (tri.start_x >= tri.end_x || tri.start_y >= tri.end_y)
+            return;
+        WorkerLists &list = lists[worker];
+        tri.clipped = list.clipped_count++;
+        slot(list.clip_weights, tri.clipped) = weights;
+        add(worker, tri);
+    }
+
+    void add(int worker, const ScreenTriangle &tri)
+    {
+        if (tri.start_x >= tri.end_x || tri.start_y >= tri.end_y)
+            return;
+
+        WorkerLists &list = lists[worker];
+        int index = list.triangle_count++;
+        slot(list.triangles, index) = tri;
+
+        int tile_x0 = tri.start_x / TILE_SIZE;
+        int tile_x1 = (tri.end_x - 1) / TILE_SIZE;
+        int tile_y0 = tri.start_y / TILE_SIZE;
+        int tile_y1 = (tri.end_y - 1) / TILE_SIZE;
+
+        for (int ty = tile_y0; ty <= tile_y1; ++ty)
+            for (int tx = tile_x0; tx <= tile_x1; ++tx)
+            {
+                int tile = ty * tiles_x + tx;
+                slot(list.tiles[tile], list.tile_counts[tile]++) = index;
+            }
+    }
+
+    // indices of the worker's triangles that touch the tile, in the order they were added
+    std::span<const int> tile(int worker, int tile) const
+    {
+        const WorkerLists &list = lists[worker];
+        return std::span<const int>(list.tiles[tile].data(), list.tile_counts[tile]);
+    }
+
+    const ScreenTriangle &triangle(int worker, int index) const { return lists[worker].triangles[index]; }
+    const CornerWeights &clip_weights(int worker, int clipped) const { return lists[worker].clip_weights[clipped]; }
+
+    // triangles binned, and pieces of clipped triangles among them, summed over the workers
+    long long binned_count() const
+    {
+        long long count = 0;
+        for (const WorkerLists &list : lists)
+            count += list.triangle_count;
+        return count;
+    }
+
+    long long clipped_count() const
+    {
+        long long count = 0;
+        for (const WorkerLists &list : lists)
+            count += list.clipped_count;
+        return count;
+    }
+
+private:
+    // one worker's output; only the first `count` entries of each array are this frame's
+    struct WorkerLists
+    {
+        std::vector<ScreenTriangle> triangles;
+        std::vector<CornerWeights> clip_weights;
+        int triangle_count = 0, clipped_count = 0;
+        std::vector<std::vector<int>> tiles; // per tile, indices into triangles
+        std::vector<int> tile_counts;
+    };
+    std::vector<WorkerLists> lists;
+
+    // entry `index` of an array written by index, doubling it when it's full
+    template <typename T>
+    static T &slot(std::vector<T> &array, int index)
+    {
+        if (static_cast<size_t>(index) >= array.size())
+            array.resize(std::max<size_t>(64, 2 * array.size()));
+        return array[index];
+    }
+};
@@ -8,22 +8,25 @@
 #include <stdexcept>
 #include <iostream>
 #include "math.hpp"
+#include "vec.hpp"
+#include "mesh.hpp"
+#include "texture.hpp"
 
 // ==================== Image Class ====================
 class Image
 {
 public:
     int width, height;
-    std::vector<vector3> pixels;
-    std::vector<double> depth;
+    std::vector<vec3r> pixels;
+    std::vector<real> depth;
 
     Image(int width = 0, int height = 0) : width(width), height(height)
     {
-        pixels.resize(width * height, vector3(0, 0, 0));
+        pixels.resize(width * height, vec3r(0, 0, 0));
         depth.resize(width * height, std::numeric_limits<float>::max());
     }
 
-    void clearPixels(const vector3 &color = vector3(0, 0, 0))
+    void clearPixels(const vec3r &color = vec3r(0, 0, 0))
     {
         std::fill(pixels.begin(), pixels.end(), color);
     }
@@ -34,132 +37,42 @@ public:
     }
 };
 
-// ==================== Texture Class ====================
-class Texture
-{
-public:
-    std::string filename;
-    Image image;
-    vector3 base_color;
-    Texture(const std::string &filename) : filename(filename)
-    {
-        if (filename == "_no_texture")
-        {
-            image = Image(1, 1);
-            base_color = vector3(255, 255, 255); // default white color
-            return;
-        }
-        std::string ext = filename.substr(filename.find_last_of(".") + 1);
-        if (ext == "bytes")
-            from_bytes(filename);
-        else if (ext == "bmp")
-            from_bmp(filename);
-        else
-            throw std::runtime_error("Unsupported texture format: " + filename);
-    }
-
-    void from_bmp(const std::string &filename)
-    {
-        std::ifstream file(filename, std::ios::binary);
-        if (!file)
-            throw std::runtime_error("Failed to open: " + filename);
-
-        file.seekg(18);
-        int32_t width, height;
-        file.read(reinterpret_cast<char *>(&width), 4);
-        file.read(reinterpret_cast<char *>(&height), 4);
-
-        file.seekg(28);
-        uint16_t bpp;
-        file.read(reinterpret_cast<char *>(&bpp), 2);
-        bool hasAlpha = (bpp == 32);
-
-        file.seekg(54);
-        image = Image(width, height);
-
-        int rowSize = ((bpp * width + 31) / 32) * 4;
-        int pixelSize = hasAlpha ? 4 : 3;
-        int padding = rowSize - (pixelSize * width);
-
-        for (int y = 0; y < height; ++y)
-        {
-            for (int x = 0; x < width; ++x)
-            {
-                unsigned char r, g, b, a = 255;
-                file.read(reinterpret_cast<char *>(&b), 1);
-                file.read(reinterpret_cast<char *>(&g), 1);
-                file.read(reinterpret_cast<char *>(&r), 1);
-                if (hasAlpha)
-                    file.read(reinterpret_cast<char *>(&a), 1);
-                image.pixels[y * width + x] = vector3(r, g, b);
-            }
-            if (padding > 0)
-                file.ignore(padding);
-        }
-
-        if (image.pixels.empty())
-            throw std::runtime_error("Failed to load texture: " + filename);
-    }
-
-    void from_bytes(const std::string &filename)
-    {
-        std::ifstream file(filename, std::ios::binary);
-        if (!file)
-            throw std::runtime_error("Failed to open: " + filename);
-
-        uint16_t w, h;
-        file.read(reinterpret_cast<char *>(&w), 2);
-        file.read(reinterpret_cast<char *>(&h), 2);
-        image = Image(w, h);
-
-        for (int y = 0; y < h; ++y)
-        {
-            for (int x = 0; x < w; ++x)
-            {
-                unsigned char r, g, b;
-                file.read(reinterpret_cast<char *>(&r), 1);
-                file.read(reinterpret_cast<char *>(&g), 1);
-                file.read(reinterpret_cast<char *>(&b), 1);
-                image.pixels[y * w + x] = vector3(r, g, b);
-            }
-        }
-    }
-
-    inline vector3 get_color(double u, double v) const
-    {
-
-        u = clamp(u, 0.0, 1.0);
-        v = clamp(v, 0.0, 1.0);
-        int x = static_cast<int>(u * (image.width - 1));
-        int y = static_cast<int>(v * (image.height - 1));
-        return image.pixels[y * image.width + x];
-    }
-};
-
 // ==================== Shader Class ====================
 class Shader
 {
 public:
-    Texture texture;
-    vector3 directional_light;
+    std::shared_ptr<const Texture> texture; // shared between models, null when the model is drawn in base_color
+    vec3r base_color;
+    vec3r directional_light;
     bool has_texture = false;
-    Shader(const std::string &texture_filename = "_no_texture", const vector3 directional_light = vector3(0.3, 1, 0.6).normalize())
-        : texture(texture_filename), directional_light(directional_light)
+    TextureFilter filter = texture_filter_setting();
+    Shader(std::shared_ptr<const Texture> texture = nullptr, const vec3r &base_color = vector3(255, 255, 255),
+           const vec3r directional_light = vector3(0.3, 1, 0.6).normalize())
+        : texture(std::move(texture)), base_color(base_color), directional_light(directional_light)
     {
-        if (texture.image.width == 0 || texture.image.height == 0)
-            throw std::runtime_error("Failed to load texture: " + texture_filename);
+        if (this->texture && (this->texture->width == 0 || this->texture->height == 0))
+            throw std::runtime_error("Failed to load texture: " + this->texture->filename);
+        has_texture = this->texture != nullptr;
     }
 
-    inline vector3 get_colour(const vector2 &uv, vector3 normal) const
+    // `uv_dx` and `uv_dy`: how much the texture coordinates change one pixel to the right and up, to pick the mip level
+    // compiled per pipeline state: `Textured` must match has_texture and `Filter` the filter; unlit draws take the colour as is
+    template <bool Textured, bool Lit, TextureFilter Filter>
+    inline vec3r get_colour(const vec2r &uv, const vec2r &uv_dx, const vec2r &uv_dy, const vec3r &normal) const
     {
-        normal = normal.normalize();
-        double light_intensity = (normal.dot(directional_light) + 1) * 0.5;
-        vector3 color = has_texture ? texture.get_color(uv.getX(), uv.getY()) : texture.base_color;
-
-        return vector3(
-            clamp(color.getX() * light_intensity, 0, 255),
-            clamp(color.getY() * light_intensity, 0, 255),
-            clamp(color.getZ() * light_intensity, 0, 255));
+        vec3r color = base_color;
+        if constexpr (Textured)
+            color = texture->sample<Filter>(uv, uv_dx, uv_dy);
+        if constexpr (!Lit)
+            return color;
+        else
+        {
+            real light_intensity = (dot(normalize(normal), directional_light) + 1) * real(0.5);
+            return vec3r(
+                std::clamp(color.x() * light_intensity, real(0), real(255)),
+                std::clamp(color.y() * light_intensity, real(0), real(255)),
+                std::clamp(color.z() * light_intensity, real(0), real(255)));
+        }
     }
 };
 
@@ -174,6 +87,11 @@ public:
     mutable bool cache_valid = false;
     mutable std::vector<vector3> cached_base, cached_inverse;
 
+    // position and scale are public, so the matrices remember what they were built from
+    mutable bool matrix_valid = false;
+    mutable vector3 matrix_position, matrix_scale;
+    mutable mat4d cached_matrix, cached_inverse_matrix;
+
     Transform(double yaw = 0, double pitch = 0, double roll = 0, vector3 position = vector3(0, 0, 0), vector3 scale = vector3(1, 1, 1))
         : yaw(yaw), pitch(pitch), roll(roll), position(position), scale(scale) {}
 
@@ -226,24 +144,50 @@ public:
         return cached_inverse;
     }
 
+    // local to world: scale along the local axes, rotate, then translate
+    const mat4d &get_matrix() const
+    {
+        auto same = [](const vector3 &a, const vector3 &b)
+        { return a.getX() == b.getX() && a.getY() == b.getY() && a.getZ() == b.getZ(); };
+        if (cache_valid && matrix_valid && same(position, matrix_position) && same(scale, matrix_scale))
+            return cached_matrix;
+
+        const auto &base = get_base_vectors();
+        cached_matrix = mat4d::from_basis(base[0] * scale.getX(), base[1] * scale.getY(), base[2] * scale.getZ(), position);
+
+        // the basis is orthonormal, so undoing it is a transpose and a division by the scale
+        vec3d inverse_scale(1 / scale.getX(), 1 / scale.getY(), 1 / scale.getZ());
+        mat4d inverse = mat4d::identity();
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 3; ++c)
+                inverse(r, c) = vec3d(base[r])[c] * inverse_scale[r];
+        vec3d translation = inverse.transform_vector(vec3d(position));
+        inverse.col[3] = vec4d(-translation[0], -translation[1], -translation[2], 1.0);
+        cached_inverse_matrix = inverse;
+
+        matrix_position = position;
+        matrix_scale = scale;
+        matrix_valid = true;
+        return cached_matrix;
+    }
+
+    // world to local
+    const mat4d &get_inverse_matrix() const
+    {
+        get_matrix(); // builds both
+        return cached_inverse_matrix;
+    }
+
     inline vector3 to_world_point(const vector3 &p) const
     {
-        std::vector<vector3> base_vectors = get_base_vectors();
-        base_vectors[0] = base_vectors[0] * scale.getX();
-        base_vectors[1] = base_vectors[1] * scale.getY();
-        base_vectors[2] = base_vectors[2] * scale.getZ();
-        return transform(base_vectors, p) + position;
+        vec3d world = get_matrix().transform_point(vec3d(p));
+        return vector3(world[0], world[1], world[2]);
     }
 
     inline vector3 to_local_point(const vector3 &p) const
     {
-        std::vector<vector3> inverse_base_vectors = get_inverse_base_vectors();
-        vector3 local_point = p - position;
-        local_point = transform(inverse_base_vectors, local_point);
-        local_point.setX(local_point.getX() / scale.getX());
-        local_point.setY(local_point.getY() / scale.getY());
-        local_point.setZ(local_point.getZ() / scale.getZ());
-        return local_point;
+        vec3d local = get_inverse_matrix().transform_point(vec3d(p));
+        return vector3(local[0], local[1], local[2]);
     }
 
     void set_rotation(double new_yaw, double new_pitch, double new_roll)
@@ -262,37 +206,118 @@ public:
         cache_valid = false;
     }
 
-    vector3 transform_normal(const vector3 &n)
+    vector3 transform_normal(const vector3 &n) const
     {
         const auto &base = get_base_vectors();
         vector3 transformed = transform(base, n);
         return transformed.normalize();
     }
+
+    vec3r transform_normal(const vec3r &n) const
+    {
+        const auto &base = get_base_vectors();
+        return normalize(vec3r(base[0]) * n[0] + vec3r(base[1]) * n[1] + vec3r(base[2]) * n[2]);
+    }
+};
+
+// which faces of a model are skipped; front faces wind clockwise on the screen, with y pointing up
+enum class CullMode
+{
+    None,
+    Back,
+    Front
 };
 
 // ==================== Model Class ====================
 class Model
 {
 public:
-    std::vector<vector3> points;
-    std::vector<vector3> normals;
-    std::vector<vector2> texture_coords;
+    // geometry is shared between models loaded from the same file
+    std::shared_ptr<const Mesh> mesh;
     Transform transform;
     Shader shader;
+    std::shared_ptr<const Mesh> occluder; // drawn into the occlusion buffer when set: the mesh itself or a simpler one inside it
+    CullMode cull = CullMode::Back;       // None for open meshes seen from both sides
+
+    Model(std::shared_ptr<const Mesh> mesh, const Transform &trans, const Shader &shader)
+        : mesh(std::move(mesh)), transform(trans), shader(shader) {}
 
-    Model(const std::vector<vector3> &pts,
-          const std::vector<vector3> &norms,
-          const std::vector<vector2> &uvs,
-          const Transform &trans,
-          const Shader &shader)
-        : points(pts), normals(norms), texture_coords(uvs), transform(trans), shader(shader) {}
+    int triangle_count() const { return mesh->triangle_count(); }
+};
+
+// a coarser mesh drawn instead of an instanced model's own for instances smaller than `pixels` on the screen
+// an instance's size on the screen is the diagonal of its world box over its distance from the camera, in pixels
+struct MeshLod
+{
+    std::shared_ptr<const Mesh> mesh;
+    double pixels;
+};
+
+// ==================== InstancedModel Class ====================
+// One mesh and shader drawn once per instance, e.g. a forest from a single tree.
+// An instance is just its local-to-world matrix; the renderer culls instances individually
+// and transforms the visible ones together, a chunk of the shared mesh at a time.
+// Distant instances can be drawn with coarser meshes, and the smallest ones left out.
+class InstancedModel
+{
+public:
+    std::shared_ptr<const Mesh> mesh;
+    Shader shader;
+    std::vector<mat4d> matrices; // one per instance, as Transform::get_matrix()
+    std::shared_ptr<const Mesh> occluder; // as Model::occluder, for every instance
+    CullMode cull = CullMode::Back;
+    std::vector<MeshLod> lods; // largest `pixels` first, see addLod()
+    double min_pixels = 0;     // instances smaller than this on the screen aren't drawn
+
+    InstancedModel(std::shared_ptr<const Mesh> mesh, const Shader &shader, const std::vector<Transform> &transforms = {})
+        : mesh(std::move(mesh)), shader(shader)
+    {
+        matrices.reserve(transforms.size());
+        for (const Transform &transform : transforms)
+            addInstance(transform);
+    }
 
-    inline vector2 get_texture_coord(int idx) const
+    // instances of a loaded model, sharing its mesh and shader
+    explicit InstancedModel(const Model &prototype, const std::vector<Transform> &transforms = {})
+        : InstancedModel(prototype.mesh, prototype.shader, transforms)
     {
-        if (idx < 0 || idx >= static_cast<int>(texture_coords.size()))
-            throw std::out_of_range("Texture coordinate index out of range");
-        return texture_coords[idx];
+        occluder = prototype.occluder;
+        cull = prototype.cull;
     }
+
+    void addInstance(const Transform &transform)
+    {
+        matrices.push_back(transform.get_matrix());
+    }
+
+    void setInstance(int instance, const Transform &transform)
+    {
+        matrices[instance] = transform.get_matrix();
+    }
+
+    // draws `lod` for instances smaller than `pixels` on the screen, unless a coarser level covers them too
+    void addLod(std::shared_ptr<const Mesh> lod, double pixels)
+    {
+        lods.push_back(MeshLod{std::move(lod), pixels});
+        std::stable_sort(lods.begin(), lods.end(), [](const MeshLod &a, const MeshLod &b)
+                         { return a.pixels > b.pixels; });
+    }
+
+    // the mesh for an instance `pixels` across on the screen, null when it is too small to draw
+    const Mesh *mesh_for(double pixels) const
+    {
+        if (pixels < min_pixels)
+            return nullptr;
+        const Mesh *chosen = mesh.get();
+        for (const MeshLod &lod : lods)
+            if (pixels < lod.pixels)
+                chosen = lod.mesh.get();
+        return chosen;
+    }
+
+    bool sized() const { return min_pixels > 0 || !lods.empty(); }
+
+    int instance_count() const { return static_cast<int>(matrices.size()); }
 };
 
 // ==================== Camera Class ====================
@@ -301,9 +326,23 @@ class Camera
 public:
     double fov;
     Transform transform;
+    double near_plane = 0.01; // view depths the frustum keeps
+    double far_plane = 1000;
 
     Camera(double fov = 60.0, const Transform &transform = Transform())
         : fov(degrees_to_radians(fov)), transform(transform) {}
+
+    // view space to screen space: x and y come out in pixels after dividing by w, z keeps the view depth
+    mat4d get_projection_matrix(int width, int height) const
+    {
+        double pixels_per_unit = height / (tan(fov / 2) * 2);
+        mat4d projection;
+        projection.col[0] = vec4d(pixels_per_unit, 0.0, 0.0, 0.0);
+        projection.col[1] = vec4d(0.0, pixels_per_unit, 0.0, 0.0);
+        projection.col[2] = vec4d(width / 2.0, height / 2.0, 1.0, 1.0);
+        projection.col[3] = vec4d(0.0, 0.0, 0.0, 0.0);
+        return projection;
+    }
 };
 
 // ==================== Scene Class ====================
@@ -311,6 +350,7 @@ class Scene
 {
 public:
     std::vector<Model> models;
+    std::vector<InstancedModel> instanced; // drawn after models
     Camera camera;
 
     Scene(const std::vector<Model> &models = {},
@@ -322,6 +362,11 @@ public:
         models.push_back(model);
     }
 
+    void addInstanced(const InstancedModel &batch)
+    {
+        instanced.push_back(batch);
+    }
+
     void setCamera(const Camera &cam)
     {
         camera = cam;
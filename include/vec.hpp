@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include <iostream>
+#include "math.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTERIZER_SSE
+#endif
+
+// precision of the hot path: vertex buffers, screen-space triangles, depth and colour
+// build with -DRASTERIZER_DOUBLE (make PRECISION=double) to run the whole renderer in double for comparison
+#ifdef RASTERIZER_DOUBLE
+using real = double;
+#else
+using real = float;
+#endif
+
+// 4-wide vectors are aligned to their size so they load straight into a SIMD register,
+// the other sizes stay tightly packed for vertex buffers
+template <typename T, int N>
+constexpr size_t vec_alignment()
+{
+    return N == 4 ? sizeof(T) * 4 : alignof(T);
+}
+
+// ==================== vec Class ====================
+template <typename T, int N>
+struct alignas(vec_alignment<T, N>()) vec
+{
+    T v[N];
+
+    vec() : v{} {}
+
+    explicit vec(T s)
+    {
+        for (int i = 0; i < N; ++i)
+            v[i] = s;
+    }
+
+    template <typename... Args, typename = std::enable_if_t<sizeof...(Args) == N && (N > 1)>>
+    vec(Args... args) : v{static_cast<T>(args)...} {}
+
+    // converts between precisions
+    template <typename U>
+    explicit vec(const vec<U, N> &other)
+    {
+        for (int i = 0; i < N; ++i)
+            v[i] = static_cast<T>(other.v[i]);
+    }
+
+    // interop with the double based vector3 / vector2
+    template <int M = N, typename = std::enable_if_t<M == 3>>
+    vec(const vector3 &other) : v{static_cast<T>(other.getX()), static_cast<T>(other.getY()), static_cast<T>(other.getZ())} {}
+
+    template <int M = N, typename = std::enable_if_t<M == 2>>
+    vec(const vector2 &other) : v{static_cast<T>(other.getX()), static_cast<T>(other.getY())} {}
+
+    T &operator[](int i) { return v[i]; }
+    const T &operator[](int i) const { return v[i]; }
+
+    T &x() { return v[0]; }
+    T &y() { return v[1]; }
+    T &z() { return v[2]; }
+    T &w() { return v[3]; }
+    const T &x() const { return v[0]; }
+    const T &y() const { return v[1]; }
+    const T &z() const { return v[2]; }
+    const T &w() const { return v[3]; }
+
+    vec &operator+=(const vec &o)
+    {
+        for (int i = 0; i < N; ++i)
+            v[i] += o.v[i];
+        return *this;
+    }
+
+    vec &operator-=(const vec &o)
+    {
+        for (int i = 0; i < N; ++i)
+            v[i] -= o.v[i];
+        return *this;
+    }
+
+    vec &operator*=(T s)
+    {
+        for (int i = 0; i < N; ++i)
+            v[i] *= s;
+        return *this;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const vec &a)
+    {
+        os << "vec" << N << "(";
+        for (int i = 0; i < N; ++i)
+            os << (i ? ", " : "") << a.v[i];
+        return os << ")";
+    }
+};
+
+using vec2f = vec<float, 2>;
+using vec3f = vec<float, 3>;
+using vec4f = vec<float, 4>;
+using vec2d = vec<double, 2>;
+using vec3d = vec<double, 3>;
+using vec4d = vec<double, 4>;
+using vec2r = vec<real, 2>;
+using vec3r = vec<real, 3>;
+using vec4r = vec<real, 4>;
+
+template <typename T, int N>
+inline vec<T, N> operator+(const vec<T, N> &a, const vec<T, N> &b)
+{
+    vec<T, N> r = a;
+    return r += b;
+}
+
+template <typename T, int N>
+inline vec<T, N> operator-(const vec<T, N> &a, const vec<T, N> &b)
+{
+    vec<T, N> r = a;
+    return r -= b;
+}
+
+template <typename T, int N>
+inline vec<T, N> operator*(const vec<T, N> &a, T s)
+{
+    vec<T, N> r = a;
+    return r *= s;
+}
+
+template <typename T, int N>
+inline vec<T, N> operator*(T s, const vec<T, N> &a) { return a * s; }
+
+// component-wise
+template <typename T, int N>
+inline vec<T, N> operator*(const vec<T, N> &a, const vec<T, N> &b)
+{
+    vec<T, N> r;
+    for (int i = 0; i < N; ++i)
+        r.v[i] = a.v[i] * b.v[i];
+    return r;
+}
+
+template <typename T, int N>
+inline T dot(const vec<T, N> &a, const vec<T, N> &b)
+{
+    T r = 0;
+    for (int i = 0; i < N; ++i)
+        r += a.v[i] * b.v[i];
+    return r;
+}
+
+template <typename T>
+inline vec<T, 3> cross(const vec<T, 3> &a, const vec<T, 3> &b)
+{
+    return vec<T, 3>(a.v[1] * b.v[2] - a.v[2] * b.v[1],
+                     a.v[2] * b.v[0] - a.v[0] * b.v[2],
+                     a.v[0] * b.v[1] - a.v[1] * b.v[0]);
+}
+
+template <typename T, int N>
+inline T length(const vec<T, N> &a) { return std::sqrt(dot(a, a)); }
+
+template <typename T, int N>
+inline vec<T, N> normalize(const vec<T, N> &a)
+{
+    T len = length(a);
+    if (len == 0)
+        return vec<T, N>();
+    return a * (T(1) / len);
+}
+
+template <typename T, int N>
+inline vec<T, N> lerp(const vec<T, N> &a, const vec<T, N> &b, T t) { return a + (b - a) * t; }
+
+template <typename T, int N>
+inline vec<T, N> min(const vec<T, N> &a, const vec<T, N> &b)
+{
+    vec<T, N> r;
+    for (int i = 0; i < N; ++i)
+        r.v[i] = std::min(a.v[i], b.v[i]);
+    return r;
+}
+
+template <typename T, int N>
+inline vec<T, N> max(const vec<T, N> &a, const vec<T, N> &b)
+{
+    vec<T, N> r;
+    for (int i = 0; i < N; ++i)
+        r.v[i] = std::max(a.v[i], b.v[i]);
+    return r;
+}
+
+#ifdef RASTERIZER_SSE
+// exact-type overloads win over the templates above
+inline __m128 load_vec4(const vec4f &a) { return _mm_load_ps(a.v); }
+inline vec4f store_vec4(__m128 m)
+{
+    vec4f r;
+    _mm_store_ps(r.v, m);
+    return r;
+}
+
+inline vec4f operator+(const vec4f &a, const vec4f &b) { return store_vec4(_mm_add_ps(load_vec4(a), load_vec4(b))); }
+inline vec4f operator-(const vec4f &a, const vec4f &b) { return store_vec4(_mm_sub_ps(load_vec4(a), load_vec4(b))); }
+inline vec4f operator*(const vec4f &a, const vec4f &b) { return store_vec4(_mm_mul_ps(load_vec4(a), load_vec4(b))); }
+inline vec4f operator*(const vec4f &a, float s) { return store_vec4(_mm_mul_ps(load_vec4(a), _mm_set1_ps(s))); }
+
+inline float dot(const vec4f &a, const vec4f &b)
+{
+    __m128 m = _mm_mul_ps(load_vec4(a), load_vec4(b));
+    __m128 shuffled = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1));
+    m = _mm_add_ps(m, shuffled);
+    shuffled = _mm_movehl_ps(shuffled, m);
+    return _mm_cvtss_f32(_mm_add_ss(m, shuffled));
+}
+#endif
+
+// ==================== mat4 Class ====================
+// column-major, acts on column vectors: p' = m * p
+template <typename T>
+struct mat4
+{
+    vec<T, 4> col[4];
+
+    mat4() {}
+
+    template <typename U>
+    explicit mat4(const mat4<U> &other)
+    {
+        for (int c = 0; c < 4; ++c)
+            col[c] = vec<T, 4>(other.col[c]);
+    }
+
+    static mat4 identity()
+    {
+        mat4 m;
+        for (int i = 0; i < 4; ++i)
+            m.col[i][i] = 1;
+        return m;
+    }
+
+    // columns are the images of the x, y and z axes, followed by the translation
+    static mat4 from_basis(const vec<T, 3> &i, const vec<T, 3> &j, const vec<T, 3> &k, const vec<T, 3> &translation)
+    {
+        mat4 m;
+        m.col[0] = vec<T, 4>(i[0], i[1], i[2], T(0));
+        m.col[1] = vec<T, 4>(j[0], j[1], j[2], T(0));
+        m.col[2] = vec<T, 4>(k[0], k[1], k[2], T(0));
+        m.col[3] = vec<T, 4>(translation[0], translation[1], translation[2], T(1));
+        return m;
+    }
+
+    T &operator()(int row, int column) { return col[column][row]; }
+    const T &operator()(int row, int column) const { return col[column][row]; }
+
+    vec<T, 4> operator*(const vec<T, 4> &p) const
+    {
+        return col[0] * p[0] + col[1] * p[1] + col[2] * p[2] + col[3] * p[3];
+    }
+
+    mat4 operator*(const mat4 &o) const
+    {
+        mat4 m;
+        for (int c = 0; c < 4; ++c)
+            m.col[c] = (*this) * o.col[c];
+        return m;
+    }
+
+    mat4 transpose() const
+    {
+        mat4 m;
+        for (int r = 0; r < 4; ++r)
+            for (int c = 0; c < 4; ++c)
+                m(r, c) = (*this)(c, r);
+        return m;
+    }
+
+    vec<T, 3> transform_point(const vec<T, 3> &p) const
+    {
+        vec<T, 4> r = (*this) * vec<T, 4>(p[0], p[1], p[2], T(1));
+        return vec<T, 3>(r[0], r[1], r[2]);
+    }
+
+    // ignores the translation
+    vec<T, 3> transform_vector(const vec<T, 3> &d) const
+    {
+        vec<T, 4> r = col[0] * d[0] + col[1] * d[1] + col[2] * d[2];
+        return vec<T, 3>(r[0], r[1], r[2]);
+    }
+};
+
+using mat4f = mat4<float>;
+using mat4d = mat4<double>;
+using mat4r = mat4<real>;
+
+#ifdef RASTERIZER_SSE
+template <>
+inline vec4f mat4f::operator*(const vec4f &p) const
+{
+    __m128 r = _mm_mul_ps(load_vec4(col[0]), _mm_set1_ps(p[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(load_vec4(col[1]), _mm_set1_ps(p[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(load_vec4(col[2]), _mm_set1_ps(p[2])));
+    r = _mm_add_ps(r, _mm_mul_ps(load_vec4(col[3]), _mm_set1_ps(p[3])));
+    return store_vec4(r);
+}
+#endif
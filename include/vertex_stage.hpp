@@ -0,0 +1,242 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include "vec.hpp"
+#include "util.hpp"
+#include "frustum.hpp"
+#include "frame_stats.hpp"
+#include "occlusion.hpp"
+
+// model -> world -> view -> screen, composed in double once per model per frame
+mat4r model_view_projection(const Transform &transform, const Camera &cam, int width, int height)
+{
+    return mat4r(cam.get_projection_matrix(width, height) * cam.transform.get_inverse_matrix() * transform.get_matrix());
+}
+
+// projects a batch of points with a composed model-view-projection matrix
+// out = (screen x, screen y, view depth, 1 / view depth)
+// points at or behind the camera keep x and y undivided, so the clipper can still cut the triangles they belong to
+void transform_points(const mat4r &mvp, std::span<const vec3r> in, std::span<vec4r> out)
+{
+    size_t count = std::min(in.size(), out.size());
+    for (size_t i = 0; i < count; ++i)
+    {
+        vec4r clip = mvp * vec4r(in[i][0], in[i][1], in[i][2], real(1));
+        real inverse_w = clip.w() > 0 ? 1 / clip.w() : real(0);
+        real scale = clip.w() > 0 ? inverse_w : real(1);
+        out[i] = vec4r(clip.x() * scale, clip.y() * scale, clip.z(), inverse_w);
+    }
+}
+
+// rotates a batch of normals into world space and renormalizes them
+void transform_normals(const mat4r &rotation, std::span<const vec3r> in, std::span<vec3r> out)
+{
+    size_t count = std::min(in.size(), out.size());
+    for (size_t i = 0; i < count; ++i)
+        out[i] = normalize(rotation.transform_vector(in[i]));
+}
+
+// a run of consecutive triangles of one mesh drawn with one transform
+// every visible model and instance becomes at least one draw, partly visible ones one per run of visible clusters
+// the run's vertices live in the frame's shared buffers: vertex v of the mesh is at slot(v)
+struct Draw
+{
+    const Mesh *mesh;
+    const Shader *shader;
+    CullMode cull;
+    mat4r mvp;
+    mat4r normal_matrix;
+    int first_triangle, triangle_count;
+    int vertex_begin, vertex_end; // the mesh vertices the run uses
+    size_t first_vertex;          // where vertex_begin's transformed copy is
+
+    size_t slot(uint32_t vertex) const { return first_vertex + (vertex - vertex_begin); }
+};
+
+// output of the vertex stage for the whole frame
+struct ScreenVertices
+{
+    std::vector<vec4r> positions; // screen x, screen y, view depth, 1 / view depth
+    std::vector<vec3r> normals;   // world space, normalized
+};
+
+// a slice of the vertex stage's work, small enough to balance across workers:
+// one range of mesh vertices for one draw, or for several draws of that same range, e.g. instances
+struct VertexJob
+{
+    int first_draw, draw_count; // into the stage's draw order
+    int begin, end;             // mesh vertex range
+};
+
+const int VERTEX_JOB_SIZE = 4096;
+
+// camera state shared by every draw of a frame
+struct ViewSetup
+{
+    mat4d projection;
+    mat4d view;
+    Frustum frustum; // view space
+
+    ViewSetup(const Camera &cam, int width, int height)
+        : projection(cam.get_projection_matrix(width, height)), view(cam.transform.get_inverse_matrix()),
+          frustum(Frustum::from_camera(cam, width, height)) {}
+};
+
+// one model, or one instance of an instanced model
+struct SceneObject
+{
+    const Mesh *mesh;
+    const Shader *shader;
+    const mat4d *matrix; // local to world
+    const Mesh *occluder; // null unless the object is an occluder
+    CullMode cull;
+    const InstancedModel *batch = nullptr; // what an instance belongs to, when its size on the screen picks its mesh
+};
+
+// the rotation of a local-to-world matrix, which is all normals need: its axes without their scale
+mat4r normal_rotation(const mat4d &matrix)
+{
+    vec3d axes[3];
+    for (int c = 0; c < 3; ++c)
+        axes[c] = normalize(vec3d(matrix.col[c][0], matrix.col[c][1], matrix.col[c][2]));
+    return mat4r::from_basis(vec3r(axes[0]), vec3r(axes[1]), vec3r(axes[2]), vec3r());
+}
+
+// culls a mesh drawn with one transform against the view frustum, first whole and then cluster by cluster,
+// and adds a draw for every run of consecutive clusters that is at least partly in view
+// `known` is what a coarser test already found out; Inside skips the tests. The caller counts the object in stats.
+// with an occlusion buffer, clusters the occluders hide are dropped as well
+void add_draws(const SceneObject &object, const ViewSetup &setup, std::vector<Draw> &draws, FrameStats &stats,
+               Visibility known = Visibility::Intersecting, const OcclusionBuffer *occlusion = nullptr)
+{
+    const Mesh &mesh = *object.mesh;
+    const mat4d &matrix = *object.matrix;
+    mat4d model_view = setup.view * matrix;
+    mat4d mvp = setup.projection * model_view;
+    Frustum frustum = setup.frustum.transformed(model_view);
+    Visibility whole = known == Visibility::Inside ? known : frustum.test(mesh.bounds);
+    if (whole == Visibility::Outside || mesh.triangle_count() == 0)
+    {
+        ++stats.objects_culled;
+        stats.triangles_culled += mesh.triangle_count();
+        return;
+    }
+
+    Draw draw;
+    draw.mesh = &mesh;
+    draw.shader = object.shader;
+    draw.cull = object.cull;
+    draw.mvp = mat4r(mvp);
+    draw.normal_matrix = normal_rotation(matrix);
+    draw.first_vertex = 0;
+
+    if ((whole == Visibility::Inside && !occlusion) || mesh.clusters.size() <= 1)
+    {
+        draw.first_triangle = 0;
+        draw.triangle_count = mesh.triangle_count();
+        draw.vertex_begin = 0;
+        draw.vertex_end = mesh.vertex_count();
+        draws.push_back(draw);
+        return;
+    }
+
+    stats.clusters += static_cast<int>(mesh.clusters.size());
+    bool open = false;
+    for (const MeshCluster &cluster : mesh.clusters)
+    {
+        bool outside = whole != Visibility::Inside && frustum.test(cluster.bounds) == Visibility::Outside;
+        bool hidden = !outside && occlusion && occlusion->hides(cluster.bounds.min, cluster.bounds.max, mvp);
+        if (outside || hidden)
+        {
+            ++stats.clusters_culled;
+            stats.triangles_culled += cluster.triangle_count;
+            if (hidden)
+            {
+                ++stats.clusters_occluded;
+                stats.triangles_occluded += cluster.triangle_count;
+            }
+            if (open)
+                draws.push_back(draw);
+            open = false;
+            continue;
+        }
+        if (!open)
+        {
+            draw.first_triangle = cluster.first_triangle;
+            draw.triangle_count = 0;
+            draw.vertex_begin = cluster.vertex_begin;
+            draw.vertex_end = cluster.vertex_end;
+            open = true;
+        }
+        draw.triangle_count += cluster.triangle_count;
+        draw.vertex_begin = std::min<int>(draw.vertex_begin, cluster.vertex_begin);
+        draw.vertex_end = std::max<int>(draw.vertex_end, cluster.vertex_end);
+    }
+    if (open)
+        draws.push_back(draw);
+}
+
+// lays the draws' vertices out in the shared buffers and splits the work into jobs
+// draws of the same vertex range of the same mesh share jobs, so each chunk of the mesh is read once for all of them
+// `order` is filled with the draws grouped that way, which is what the jobs index
+void prepare_vertex_stage(std::vector<Draw> &draws, ScreenVertices &vertices, std::vector<VertexJob> &jobs, std::vector<int> &order)
+{
+    jobs.clear();
+    size_t total = 0;
+    for (Draw &draw : draws)
+    {
+        draw.first_vertex = total;
+        total += draw.vertex_end - draw.vertex_begin;
+    }
+    // normals share the positions' layout; draws without normals leave their slots unused
+    vertices.positions.resize(total);
+    vertices.normals.resize(total);
+
+    order.resize(draws.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+              {
+                  const Draw &x = draws[a], &y = draws[b];
+                  if (x.mesh != y.mesh)
+                      return std::less<const Mesh *>()(x.mesh, y.mesh);
+                  if (x.vertex_begin != y.vertex_begin)
+                      return x.vertex_begin < y.vertex_begin;
+                  if (x.vertex_end != y.vertex_end)
+                      return x.vertex_end < y.vertex_end;
+                  return a < b; });
+    for (size_t first = 0; first < order.size();)
+    {
+        const Draw &draw = draws[order[first]];
+        size_t last = first + 1;
+        while (last < order.size() && draws[order[last]].mesh == draw.mesh &&
+               draws[order[last]].vertex_begin == draw.vertex_begin && draws[order[last]].vertex_end == draw.vertex_end)
+            ++last;
+        // about VERTEX_JOB_SIZE vertices transformed per job, however they split between chunk and draws
+        for (int begin = draw.vertex_begin; begin < draw.vertex_end; begin += VERTEX_JOB_SIZE)
+        {
+            int end = std::min(begin + VERTEX_JOB_SIZE, draw.vertex_end);
+            int per_job = std::max(1, VERTEX_JOB_SIZE / (end - begin));
+            for (size_t d = first; d < last; d += per_job)
+                jobs.push_back({static_cast<int>(d), static_cast<int>(std::min<size_t>(per_job, last - d)), begin, end});
+        }
+        first = last;
+    }
+}
+
+void run_vertex_job(const std::vector<Draw> &draws, const std::vector<int> &order, ScreenVertices &vertices, const VertexJob &job)
+{
+    size_t count = job.end - job.begin;
+    for (int i = job.first_draw; i < job.first_draw + job.draw_count; ++i)
+    {
+        const Draw &draw = draws[order[i]];
+        const Mesh &mesh = *draw.mesh;
+        size_t first = draw.slot(job.begin);
+        transform_points(draw.mvp, mesh.positions.subspan(job.begin, count), std::span<vec4r>(vertices.positions).subspan(first, count));
+        if (mesh.has_normals())
+            transform_normals(draw.normal_matrix, mesh.normals.subspan(job.begin, count), std::span<vec3r>(vertices.normals).subspan(first, count));
+    }
+}
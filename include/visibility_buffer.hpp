@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+// RASTERIZER_DEFERRED=1 shades through the visibility buffer, for comparing against forward shading
+inline bool deferred_shading_enabled()
+{
+    const char *setting = std::getenv("RASTERIZER_DEFERRED");
+    return setting && std::string(setting) == "1";
+}
+
+// ==================== VisibilityBuffer Class ====================
+// The binned triangle visible at each pixel, for deferred shading: rasterizing writes only depth and this id,
+// then every pixel of the tile is shaded once from the triangle it ended up with.
+// An id packs the binning worker into its low bits and the triangle's index in that worker's list above them,
+// plus one, so 0 means nothing was drawn. Like the Hi-Z, a tile's ids are only touched by the worker rendering it.
+class VisibilityBuffer
+{
+public:
+    int width;
+    std::vector<uint32_t> ids;
+    bool enabled = deferred_shading_enabled();
+
+    VisibilityBuffer(int width = 0, int height = 0, int workers = 1) : width(width), ids(width * height, 0)
+    {
+        while ((1 << worker_bits) < workers)
+            ++worker_bits;
+    }
+
+    uint32_t id(int worker, int index) const { return ((static_cast<uint32_t>(index) << worker_bits) | worker) + 1; }
+
+    void decode(uint32_t id, int &worker, int &index) const
+    {
+        --id;
+        worker = static_cast<int>(id & ((1u << worker_bits) - 1));
+        index = static_cast<int>(id >> worker_bits);
+    }
+
+    // forgets what the last frame drew in [min_x, max_x) x [min_y, max_y)
+    void clear(int min_x, int max_x, int min_y, int max_y)
+    {
+        for (int y = min_y; y < max_y; ++y)
+            std::fill(ids.begin() + y * width + min_x, ids.begin() + y * width + max_x, 0);
+    }
+
+private:
+    int worker_bits = 0;
+};
@@ -1,8 +1,45 @@
 #include "../include/rasterizer.hpp"
 using namespace std;
 
-int main()
+// usage: bin/app                   interactive window
+//        bin/app --headless [--scene rotation|main] [--frames N] [--fps N] [--format y4m|rgba] [--output file|-]
+//        renders without a window and streams the frames to a file or stdout, e.g.
+//        bin/app --headless --scene main | ffmpeg -i - turntable.mp4
+
+int main(int argc, char *argv[])
 {
-    real_time_render();
-    return 0;
+    if (argc == 1)
+    {
+        real_time_render();
+        return 0;
+    }
+
+    HeadlessOptions options;
+    bool headless = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--headless")
+            headless = true;
+        else if (arg == "--scene" && has_value)
+            options.scene = argv[++i];
+        else if (arg == "--frames" && has_value)
+            options.frames = atoi(argv[++i]);
+        else if (arg == "--fps" && has_value)
+            options.fps = max(atoi(argv[++i]), 1);
+        else if (arg == "--output" && has_value)
+            options.output = argv[++i];
+        else if (!(arg == "--format" && has_value && parse_video_format(argv[++i], options.format)))
+        {
+            headless = false;
+            break;
+        }
+    }
+    if (!headless)
+    {
+        fprintf(stderr, "usage: %s [--headless [--scene rotation|main] [--frames N] [--fps N] [--format y4m|rgba] [--output file|-]]\n", argv[0]);
+        return 1;
+    }
+    return headless_render(options) ? 0 : 1;
 }
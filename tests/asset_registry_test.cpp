@@ -0,0 +1,99 @@
+#include "../include/object_loader.hpp"
+#include <chrono>
+#include <cstdio>
+#include <future>
+
+// the same asset asked for from several pool tasks at once, including from inside its own load
+// every case must finish; a deadlock shows as a timeout
+// usage: bin/asset_registry_test
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+    std::printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    failures += !ok;
+}
+
+// runs `test` with a time limit, a hang being the failure these cases look for
+template <typename Test>
+bool finishes(Test test, int seconds = 60)
+{
+    auto result = std::async(std::launch::async, test);
+    if (result.wait_for(std::chrono::seconds(seconds)) != std::future_status::ready)
+    {
+        std::printf("FAIL: timed out, deadlocked\n");
+        std::fflush(stdout);
+        std::_Exit(1);
+    }
+    return result.get();
+}
+
+// a load that helps the pool the way parse_obj's parallel_for does, and picks up a second request for its own key
+bool nested_request_for_the_loading_key()
+{
+    std::shared_ptr<const Mesh> inner;
+    std::atomic<bool> done{false};
+    auto outer = assets().mesh("nested", [&]()
+                               {
+                                   thread_pool().submit([&]()
+                                                        {
+                                                            inner = assets().mesh("nested", []()
+                                                                                  { return std::make_shared<const Mesh>(); });
+                                                            done = true;
+                                                        });
+                                   // on a single thread the request runs right here, inside this load
+                                   thread_pool().run_pending_task();
+                                   return std::make_shared<const Mesh>(); });
+    // a worker that took the request instead waits for this load, and finishes now it's done
+    while (!done)
+        thread_pool().run_pending_task();
+    return outer && inner;
+}
+
+// an .obj large enough that parse_obj splits it across the pool, about 6 MB
+std::string write_large_obj()
+{
+    std::string path = "/tmp/asset_registry_test_large.obj";
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    int n = 300;
+    for (int y = 0; y <= n; ++y)
+        for (int x = 0; x <= n; ++x)
+            std::fprintf(file, "v %.6f %.6f %.6f\n", x * 0.01, y * 0.01, (x * y % 7) * 0.001);
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x)
+        {
+            int a = y * (n + 1) + x + 1, b = a + 1, c = a + n + 1, d = c + 1;
+            std::fprintf(file, "f %d %d %d\nf %d %d %d\n", a, b, d, a, d, c);
+        }
+    std::fclose(file);
+    return path;
+}
+
+// six graph tasks loading the same large mesh
+bool graph_tasks_loading_one_large_mesh(const std::string &path)
+{
+    std::vector<std::shared_ptr<const Mesh>> meshes(6);
+    TaskGraph graph;
+    for (size_t i = 0; i < meshes.size(); ++i)
+        graph.add([&, i]()
+                  { meshes[i] = load_object(path).mesh; });
+    graph.run(thread_pool());
+    for (const auto &mesh : meshes)
+        if (!mesh || mesh->triangle_count() != meshes[0]->triangle_count() || mesh->triangle_count() == 0)
+            return false;
+    return true;
+}
+
+int main()
+{
+    setenv("RASTERIZER_MESH_CACHE", "0", 1); // parse every time, the parse is what the pool helps with
+    check(finishes(nested_request_for_the_loading_key), "a request for a key made inside its own load");
+    std::string path = write_large_obj();
+    for (int run = 0; run < 5; ++run)
+        check(finishes([&]()
+                       { return graph_tasks_loading_one_large_mesh(path); }),
+              "graph tasks loading one large mesh");
+    std::remove(path.c_str());
+    return failures == 0 ? 0 : 1;
+}
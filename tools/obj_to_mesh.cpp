@@ -0,0 +1,57 @@
+#include "../include/object_loader.hpp"
+#include <chrono>
+#include <cstdio>
+
+// converts .obj files into the binary mesh cache ahead of time, so the first launch doesn't parse them either
+// usage: bin/obj_to_mesh [--textured] [--no-optimize] file.obj ...
+//   --textured     read a/b faces as position/uv, as load_object does when given a texture
+//   --no-optimize  keep the file's triangle order
+
+int main(int argc, char *argv[])
+{
+    bool two_part_is_normal = true;
+    bool optimize = true;
+    int converted = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--textured")
+        {
+            two_part_is_normal = false;
+            continue;
+        }
+        if (arg == "--no-optimize")
+        {
+            optimize = false;
+            continue;
+        }
+
+        try
+        {
+            uint32_t flags = (two_part_is_normal ? MESH_CACHE_TWO_PART_IS_NORMAL : 0) | (optimize ? MESH_CACHE_OPTIMIZED : 0);
+            auto start = std::chrono::steady_clock::now();
+            Mesh mesh(load_mesh_data(arg, two_part_is_normal, optimize));
+            if (!write_mesh_cache(arg, mesh, flags))
+            {
+                std::fprintf(stderr, "%s: couldn't write %s\n", arg.c_str(), mesh_cache_path(arg).c_str());
+                return 1;
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::printf("%s -> %s: %d vertices, %d triangles, %.1f KB (%.2f ms)\n", arg.c_str(), mesh_cache_path(arg).c_str(),
+                        mesh.vertex_count(), mesh.triangle_count(), mesh.memory_bytes() / 1024.0, ms);
+            ++converted;
+        }
+        catch (const std::exception &e)
+        {
+            std::fprintf(stderr, "%s: %s\n", arg.c_str(), e.what());
+            return 1;
+        }
+    }
+
+    if (converted == 0)
+    {
+        std::fprintf(stderr, "usage: %s [--textured] [--no-optimize] file.obj ...\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}